@@ -0,0 +1,257 @@
+#ifndef __BRANCHBOUNDS_H_
+#define __BRANCHBOUNDS_H_
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+
+#include "Angel.h"
+
+using std::vector;
+using std::pair;
+
+// axis aligned box, empty until something is added
+struct Bounds {
+	vec3 min, max;
+	bool empty;
+
+	Bounds() {
+		empty = true;
+	}
+
+	void add(const vec3& point) {
+		if(empty) {
+			min = max = point;
+			empty = false;
+			return;
+		}
+		for(int i = 0; i < 3; i++) {
+			min[i] = std::min(min[i], point[i]);
+			max[i] = std::max(max[i], point[i]);
+		}
+	}
+
+	void add(const Bounds& other) {
+		if(!other.empty) {
+			add(other.min);
+			add(other.max);
+		}
+	}
+
+	// box around the box from boxMin to boxMax once transformed by m
+	static Bounds transformed(const mat4& m, const vec3& boxMin, const vec3& boxMax) {
+		vec3 center = (boxMin + boxMax) / 2;
+		vec3 half = (boxMax - boxMin) / 2;
+		Bounds bounds;
+		for(int row = 0; row < 3; row++) {
+			float c = m[row][3], extent = 0;
+			for(int col = 0; col < 3; col++) {
+				c += m[row][col] * center[col];
+				extent += fabs(m[row][col]) * half[col];
+			}
+			bounds.min[row] = c - extent;
+			bounds.max[row] = c + extent;
+		}
+		bounds.empty = false;
+		return bounds;
+	}
+};
+
+// the six planes of a view volume, pulled out of a projection matrix
+class ViewFrustum {
+	private:
+		vec4 planes[6]; // inside is where dot(plane, point) >= 0
+
+	public:
+		enum Result { OUTSIDE, INTERSECTS, INSIDE };
+
+		// projection takes world space to clip space
+		ViewFrustum(const mat4& projection) {
+			for(int axis = 0; axis < 3; axis++) {
+				planes[axis * 2] = projection[3] + projection[axis];
+				planes[axis * 2 + 1] = projection[3] - projection[axis];
+			}
+		}
+
+		Result test(const Bounds& bounds) const {
+			if(bounds.empty) {
+				return OUTSIDE;
+			}
+			Result result = INSIDE;
+			for(int i = 0; i < 6; i++) {
+				const vec4& p = planes[i];
+				// corners furthest along and against the plane's normal
+				vec3 far(p.x >= 0 ? bounds.max.x : bounds.min.x,
+				         p.y >= 0 ? bounds.max.y : bounds.min.y,
+				         p.z >= 0 ? bounds.max.z : bounds.min.z);
+				vec3 near(p.x >= 0 ? bounds.min.x : bounds.max.x,
+				          p.y >= 0 ? bounds.min.y : bounds.max.y,
+				          p.z >= 0 ? bounds.min.z : bounds.max.z);
+				if(p.x * far.x + p.y * far.y + p.z * far.z + p.w < 0) {
+					return OUTSIDE;
+				}
+				if(p.x * near.x + p.y * near.y + p.z * near.z + p.w < 0) {
+					result = INTERSECTS;
+				}
+			}
+			return result;
+		}
+};
+
+// a box around every bracketed branch of a tree, nested like the brackets
+// segments are numbered in drawing order, so a branch is a range of them
+class BranchBounds {
+	public:
+		typedef pair<size_t, size_t> Range; // [first, second) of segments
+
+	private:
+		enum { NONE = ~0u }; // no node
+
+		struct Node {
+			Range segments;
+			Bounds bounds;
+			unsigned firstChild;
+			unsigned nextSibling;
+		};
+
+		vector<Node> nodes; // 0 is the whole tree, parents before children
+
+		// ranges sorted with parents first, longest first among equals
+		static bool outerFirst(const Range& a, const Range& b) {
+			return a.first != b.first ? a.first < b.first : a.second > b.second;
+		}
+
+		// call visible(first, last) for every range of node that's
+		// at least partly in view, adding skipped segments to culled
+		template<typename Visitor>
+		void cull(unsigned index, const ViewFrustum& frustum, Visitor& visible,
+				unsigned long long& culled) const {
+			const Node& node = nodes[index];
+			ViewFrustum::Result result = frustum.test(node.bounds);
+			if(result == ViewFrustum::OUTSIDE) {
+				culled += node.segments.second - node.segments.first;
+				return;
+			}
+			if(result == ViewFrustum::INSIDE || node.firstChild == NONE) {
+				visible(node.segments.first, node.segments.second);
+				return;
+			}
+			size_t position = node.segments.first;
+			for(unsigned child = node.firstChild; child != NONE; child = nodes[child].nextSibling) {
+				if(position < nodes[child].segments.first) {
+					visible(position, nodes[child].segments.first);
+				}
+				cull(child, frustum, visible, culled);
+				position = nodes[child].segments.second;
+			}
+			if(position < node.segments.second) {
+				visible(position, node.segments.second);
+			}
+		}
+
+	public:
+		// nest branches inside a root covering all count segments, and box
+		// each one with segmentBounds(i), the bounds of segment i
+		// branches must nest like brackets do, any order is fine
+		template<typename SegmentBounds>
+		void build(vector<Range>& branches, size_t count, SegmentBounds segmentBounds) {
+			nodes.clear();
+			std::sort(branches.begin(), branches.end(), outerFirst);
+			Node root;
+			root.segments = Range(0, count);
+			root.firstChild = root.nextSibling = NONE;
+			nodes.push_back(root);
+
+			// link each branch under the innermost one containing it
+			vector<unsigned> open(1, 0);
+			vector<unsigned> lastChild(1, NONE);
+			for(vector<Range>::const_iterator i = branches.begin(); i != branches.end(); ++i) {
+				if(i->first >= i->second || (i == branches.begin() ? false : *i == *(i - 1))) {
+					continue; // empty, or the same segments as the branch around it
+				}
+				while(nodes[open.back()].segments.second < i->second) {
+					open.pop_back();
+					lastChild.pop_back();
+				}
+				Node node;
+				node.segments = *i;
+				node.firstChild = node.nextSibling = NONE;
+				unsigned index = nodes.size();
+				nodes.push_back(node);
+				if(lastChild.back() == NONE) {
+					nodes[open.back()].firstChild = index;
+				} else {
+					nodes[lastChild.back()].nextSibling = index;
+				}
+				lastChild.back() = index;
+				open.push_back(index);
+				lastChild.push_back(NONE);
+			}
+
+			// children come after their parents, so go backwards to box them first
+			for(size_t n = nodes.size(); n-- > 0;) {
+				Node& node = nodes[n];
+				size_t position = node.segments.first;
+				for(unsigned child = node.firstChild; child != NONE; child = nodes[child].nextSibling) {
+					for(; position < nodes[child].segments.first; position++) {
+						node.bounds.add(segmentBounds(position));
+					}
+					node.bounds.add(nodes[child].bounds);
+					position = nodes[child].segments.second;
+				}
+				for(; position < node.segments.second; position++) {
+					node.bounds.add(segmentBounds(position));
+				}
+			}
+		}
+
+		void clear() {
+			nodes.clear();
+		}
+
+		// grow or shrink every box by factor about center
+		void scaleAbout(const vec3& center, float factor) {
+			for(vector<Node>::iterator i = nodes.begin(); i != nodes.end(); ++i) {
+				if(!i->bounds.empty) {
+					i->bounds.min = center + factor * (i->bounds.min - center);
+					i->bounds.max = center + factor * (i->bounds.max - center);
+				}
+			}
+		}
+
+		unsigned getNumBranches() const {
+			return nodes.empty() ? 0 : nodes.size() - 1;
+		}
+
+		const Bounds& getBounds() const {
+			return nodes[0].bounds;
+		}
+
+		// call visible(first, last) for each run of segments that might be
+		// in view, joining neighbouring runs, and return how many were culled
+		template<typename Visitor>
+		unsigned long long cull(const ViewFrustum& frustum, Visitor& visible) const {
+			unsigned long long culled = 0;
+			if(nodes.empty()) {
+				return culled;
+			}
+			size_t runFirst = 0, runLast = 0;
+			auto join = [&](size_t first, size_t last) {
+				if(first != runLast || runFirst == runLast) {
+					if(runFirst != runLast) {
+						visible(runFirst, runLast);
+					}
+					runFirst = first;
+				}
+				runLast = last;
+			};
+			cull(0, frustum, join, culled);
+			if(runFirst != runLast) {
+				visible(runFirst, runLast);
+			}
+			return culled;
+		}
+};
+
+#endif
@@ -0,0 +1,171 @@
+
+#ifndef __COMPILEDGRAMMAR_H_
+#define __COMPILEDGRAMMAR_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <climits>
+
+using std::string;
+using std::map;
+using std::vector;
+
+// an L-system's rules flattened into direct-indexed lookup tables
+// every char maps to a span of one contiguous arena, so expanding a symbol
+// is an array index instead of a map search
+class CompiledGrammar {
+	public:
+		// which table to expand with
+		// FINAL is RULES with the replacements folded in, used for the last
+		// generation so replacements never need a pass of their own
+		// REPLACEMENTS is just the replacements, for systems with no iterations
+		enum Pass { RULES, FINAL, REPLACEMENTS, NUM_PASSES };
+
+		struct Span {
+			unsigned offset;
+			unsigned length;
+		};
+
+		// size of a derived string, worked out without deriving it
+		struct DerivationSize {
+			unsigned long long length;   // number of symbols
+			unsigned long long segments; // number of F symbols
+			long long depth;             // bracket depth at the end
+			long long maxDepth;          // deepest bracket nesting reached
+
+			DerivationSize() : length(0), segments(0), depth(0), maxDepth(0) {
+			}
+
+			// grow to the size of this string followed by other
+			void append(const DerivationSize& other) {
+				length = saturatingAdd(length, other.length);
+				segments = saturatingAdd(segments, other.segments);
+				maxDepth = std::max(maxDepth, saturatingAdd(depth, other.maxDepth));
+				depth = saturatingAdd(depth, other.depth);
+			}
+		};
+
+		static unsigned long long saturatingAdd(unsigned long long a, unsigned long long b) {
+			return a > ULLONG_MAX - b ? ULLONG_MAX : a + b;
+		}
+
+		// clamped to LLONG_MIN and LLONG_MAX rather than overflowing
+		static long long saturatingAdd(long long a, long long b) {
+			if(b > 0 && a > LLONG_MAX - b) {
+				return LLONG_MAX;
+			}
+			if(b < 0 && a < LLONG_MIN - b) {
+				return LLONG_MIN;
+			}
+			return a + b;
+		}
+
+	private:
+		string arena;
+		Span tables[NUM_PASSES][256];
+		bool identity[NUM_PASSES][256]; // true if char expands to itself
+
+		// apply replacements to str, a space means remove the character
+		static string replace(const string& str, const map<char, char>& replacements) {
+			string replaced = "";
+			for(string::const_iterator it = str.begin(); it != str.end(); ++it) {
+				map<char, char>::const_iterator rep = replacements.find(*it);
+				if(rep == replacements.end()) {
+					replaced += *it;
+				} else if(rep->second != ' ') {
+					replaced += rep->second;
+				}
+			}
+			return replaced;
+		}
+
+		void setSpan(Pass pass, unsigned char c, const string& rhs) {
+			Span span;
+			span.offset = arena.size();
+			span.length = rhs.size();
+			arena += rhs;
+			tables[pass][c] = span;
+			identity[pass][c] = rhs.size() == 1 && (unsigned char)rhs[0] == c;
+		}
+
+		// size of every char once expanded by pass, given the sizes of the
+		// chars it expands to - this is one multiplication by the symbol
+		// count growth matrix, done a row at a time
+		void expandSizes(Pass pass, const vector<DerivationSize>& in,
+				vector<DerivationSize>& out) const {
+			for(unsigned c = 0; c < 256; c++) {
+				DerivationSize size;
+				const Span& span = tables[pass][c];
+				for(unsigned i = span.offset; i < span.offset + span.length; i++) {
+					size.append(in[(unsigned char)arena[i]]);
+				}
+				out[c] = size;
+			}
+		}
+
+	public:
+		CompiledGrammar(const map<char, string>& grammar,
+				const map<char, char>& replacements) {
+			for(unsigned c = 0; c < 256; c++) {
+				string self(1, (char)c);
+				map<char, string>::const_iterator rule = grammar.find((char)c);
+				string rhs = rule == grammar.end() ? self : rule->second;
+				setSpan(RULES, c, rhs);
+				setSpan(FINAL, c, replace(rhs, replacements));
+				setSpan(REPLACEMENTS, c, replace(self, replacements));
+			}
+		}
+
+		const Span* getTable(Pass pass) const {
+			return tables[pass];
+		}
+
+		const char* getArena() const {
+			return arena.data();
+		}
+
+		const char* getExpansion(Pass pass, char c) const {
+			return arena.data() + tables[pass][(unsigned char)c].offset;
+		}
+
+		unsigned getExpansionLength(Pass pass, char c) const {
+			return tables[pass][(unsigned char)c].length;
+		}
+
+		// predict the size of start after applying the rules iterations times
+		// final means the last pass folds in the replacements, giving the
+		// finished turtle string rather than an intermediate generation
+		DerivationSize predict(const string& start, unsigned iterations, bool final) const {
+			// sizes of each char as it appears in the finished string
+			vector<DerivationSize> sizes(256), expanded(256);
+			for(unsigned c = 0; c < 256; c++) {
+				sizes[c].length = 1;
+				sizes[c].segments = c == 'F' ? 1 : 0;
+				sizes[c].depth = c == '[' ? 1 : (c == ']' ? -1 : 0);
+				sizes[c].maxDepth = std::max(0LL, sizes[c].depth);
+			}
+			if(final && iterations == 0) {
+				expandSizes(REPLACEMENTS, sizes, expanded);
+				sizes.swap(expanded);
+			}
+			for(unsigned k = 1; k <= iterations; k++) {
+				expandSizes(final && k == 1 ? FINAL : RULES, sizes, expanded);
+				sizes.swap(expanded);
+			}
+
+			DerivationSize total;
+			for(string::const_iterator it = start.begin(); it != start.end(); ++it) {
+				total.append(sizes[(unsigned char)*it]);
+			}
+			return total;
+		}
+
+		// true if the pass leaves c unchanged
+		bool isIdentity(Pass pass, char c) const {
+			return identity[pass][(unsigned char)c];
+		}
+};
+
+#endif
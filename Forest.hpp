@@ -0,0 +1,175 @@
+#ifndef __FOREST_H_
+#define __FOREST_H_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Angel.h"
+#include "Parallel.hpp"
+#include "BranchBounds.hpp"
+
+using std::vector;
+
+// small random number generator with its own state (splitmix64)
+// each tree gets one seeded from the forest's seed and its index, so the
+// same forest comes out however many threads plant it
+class SeededRandom {
+	private:
+		unsigned long long state;
+
+	public:
+		SeededRandom(unsigned long long seed, unsigned long long stream) {
+			state = seed ^ (stream * 0xd1b54a32d192ed03ULL);
+		}
+
+		unsigned long long next() {
+			unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			return z ^ (z >> 31);
+		}
+
+		// uniform in [lower, upper)
+		float uniform(float lower, float upper) {
+			return lower + (next() >> 40) / (float)(1 << 24) * (upper - lower);
+		}
+};
+
+// one tree of the forest, drawn with its system's shared geometry
+struct ForestTree {
+	unsigned system; // index into the renderer's systems
+	vec3 position;
+	vec4 color;
+};
+
+// where every tree in the forest stands, indexed by a uniform grid of
+// square cells over the ground (x and z) so whole cells can be culled
+// or given a level of detail at once
+class Forest {
+	private:
+		vector<ForestTree> trees;
+		float cellSize;
+		vec3 gridMin;
+		unsigned columns;
+		unsigned rows;
+		vector<unsigned> cellStart; // cell c holds cellTrees[cellStart[c], cellStart[c+1])
+		vector<unsigned> cellTrees; // tree indices grouped by cell
+		vector<Bounds> cellBounds;  // box around the positions in each cell
+
+		unsigned cellOf(const vec3& position) const {
+			unsigned column = std::min(columns - 1, (unsigned)((position.x - gridMin.x) / cellSize));
+			unsigned row = std::min(rows - 1, (unsigned)((position.z - gridMin.z) / cellSize));
+			return row * columns + column;
+		}
+
+		// bucket the trees by cell
+		void buildGrid() {
+			Bounds extent;
+			for(vector<ForestTree>::const_iterator i = trees.begin(); i != trees.end(); ++i) {
+				extent.add(i->position);
+			}
+			gridMin = extent.empty ? vec3() : extent.min;
+			vec3 size = extent.empty ? vec3() : extent.max - extent.min;
+			columns = (unsigned)(size.x / cellSize) + 1;
+			rows = (unsigned)(size.z / cellSize) + 1;
+
+			unsigned cells = columns * rows;
+			cellStart.assign(cells + 1, 0);
+			cellBounds.assign(cells, Bounds());
+			for(unsigned i = 0; i < trees.size(); i++) {
+				unsigned cell = cellOf(trees[i].position);
+				cellStart[cell + 1]++;
+				cellBounds[cell].add(trees[i].position);
+			}
+			for(unsigned c = 0; c < cells; c++) {
+				cellStart[c + 1] += cellStart[c];
+			}
+			cellTrees.resize(trees.size());
+			vector<unsigned> next(cellStart.begin(), cellStart.end() - 1);
+			for(unsigned i = 0; i < trees.size(); i++) {
+				cellTrees[next[cellOf(trees[i].position)]++] = i;
+			}
+		}
+
+	public:
+		// most trees plant will put down, however dense it's asked for
+		static const size_t maxTrees = 1 << 20;
+
+		// cellSize is the width of a grid cell in world units
+		Forest(float cellSize) {
+			this->cellSize = cellSize;
+			columns = rows = 0;
+		}
+
+		// put one tree at position
+		void plantOne(unsigned system, const vec3& position, const vec4& color) {
+			trees.clear();
+			ForestTree tree = { system, position, color };
+			trees.push_back(tree);
+			buildGrid();
+		}
+
+		// fill the box from min to max with density trees per square unit
+		// of ground, picking one of systems systems for each
+		// the same seed always plants the same forest
+		// no more than maxTrees are planted
+		void plant(const vec3& min, const vec3& max, float density, unsigned systems,
+				unsigned long long seed) {
+			double area = (max.x - min.x) * (max.z - min.z);
+			double wanted = std::max(0.0, density * area + 0.5);
+			trees.resize((size_t)std::min(wanted, (double)maxTrees));
+			size_t count = trees.size();
+			unsigned workers = count < 4096 ? 1 : workerCount();
+			size_t chunk = (count + workers - 1) / workers;
+			parallelFor(workers, [&](unsigned w) {
+				size_t end = std::min(count, (w + 1) * chunk);
+				for(size_t i = w * chunk; i < end; i++) {
+					SeededRandom random(seed, i);
+					ForestTree& tree = trees[i];
+					tree.system = random.next() % systems;
+					for(int axis = 0; axis < 3; axis++) {
+						tree.position[axis] = random.uniform(min[axis], max[axis]);
+					}
+					tree.color = vec4(random.uniform(0, 1), random.uniform(0, 1),
+						random.uniform(0, 1), 1);
+				}
+			});
+			buildGrid();
+		}
+
+		unsigned size() const {
+			return trees.size();
+		}
+
+		const ForestTree& getTree(unsigned index) const {
+			return trees[index];
+		}
+
+		unsigned getNumCells() const {
+			return columns * rows;
+		}
+
+		// indices of the trees in cell, as [begin, end)
+		const unsigned* cellBegin(unsigned cell) const {
+			return cellTrees.empty() ? NULL : &cellTrees[0] + cellStart[cell];
+		}
+
+		const unsigned* cellEnd(unsigned cell) const {
+			return cellTrees.empty() ? NULL : &cellTrees[0] + cellStart[cell + 1];
+		}
+
+		// box around everything in cell, for trees that fit in treeBounds
+		// around their positions
+		Bounds getCellBounds(unsigned cell, const Bounds& treeBounds) const {
+			Bounds bounds;
+			const Bounds& positions = cellBounds[cell];
+			if(!positions.empty && !treeBounds.empty) {
+				bounds.add(positions.min + treeBounds.min);
+				bounds.add(positions.max + treeBounds.max);
+			}
+			return bounds;
+		}
+};
+
+#endif
@@ -5,9 +5,18 @@
 #include <string>
 #include <map>
 #include <stdexcept>
-#include <stack>
+#include <vector>
+#include <algorithm>
 
 #include "Angel.h"
+#include "Turtle.hpp"
+#include "Parallel.hpp"
+#include "CompiledGrammar.hpp"
+#include "TurtleSource.hpp"
+#include "TurtleRope.hpp"
+#include "TurtleCache.hpp"
+#include "TurtleProgram.hpp"
+#include "SubtreeInstancer.hpp"
 
 using std::string;
 using std::map;
@@ -15,131 +24,227 @@ using std::pair;
 using std::runtime_error;
 using std::cout;
 using std::endl;
-using std::stack;
+using std::vector;
 
-// contains basic drawing parameters
-// modifies a given transform matrix stack according to commands
-class Turtle {
+class LSystem {
 	private:
-		void ensureCtm() {
-			if(ctm == NULL || ctm->empty()) {
-				throw runtime_error("Turtle ctm must be non-null, non-empty");
-			}
-		}
+		string name;
+		map<char, char> replacements;
+		map<char, string> grammar;
+		string turtleString;
+		int turtleIterations; // iterations turtleString is for, -1 if none
+		vector<string> generations; // raw generations, kept as checkpoints
+		bool fixedPoint; // true if generations stopped changing
 
-	public:
-		unsigned segmentLength;
-		float thickness;
-		const float defaultThickness;
-		vec3 rotations;
-		stack<mat4>* ctm;
-		enum Axis { X, Y, Z };
+		CompiledGrammar* compiled;
+		unsigned revision; // bumped whenever the turtle string may change
+		TurtleRope* rope;
+		TurtleProgram* program;
+		int programIterations; // iterations program was compiled for
+		SubtreeInstancer* instancer; // built from rope, so freed with it
+		CompiledGrammar::DerivationSize size; // predicted for sizeIterations
+		int sizeIterations;
+		string sizeStart;
+		TurtleCache* cache;
+		MappedFile cached; // turtle string loaded from cache
+		unsigned long long cachedHash; // key of what's in cached
 
-		Turtle():defaultThickness(0.25) {
-			segmentLength = 0;
-			thickness = defaultThickness;
-			rotations = vec3(0, 0, 0);
-			ctm = NULL;
-		}
+		// the copy constructor leaves derived state behind, assigning
+		// would share the owned pointers instead
+		LSystem& operator=(const LSystem&);
 
-		Turtle(const Turtle& other):defaultThickness(0.25) {
-			segmentLength = other.segmentLength;
-			thickness = other.thickness;
-			rotations = other.rotations;
-			ctm = other.ctm;
+		// map the turtle string for the current iterations from the cache
+		// returns false if there is no cache or it doesn't have the string
+		bool loadCached() {
+			if(cache == NULL) {
+				return false;
+			}
+			unsigned long long hash = getGrammarHash();
+			if(cached.getData() != NULL && cachedHash == hash) {
+				return true;
+			}
+			cached.close();
+			if(!cache->load(hash, cached)) {
+				return false;
+			}
+			cachedHash = hash;
+			return true;
 		}
 
-		void rotate(Axis axis, bool positive) {
-			ensureCtm();
-			mat4 operand;
-			float theta = (positive ? 1 : -1) * rotations[axis];
-			if(axis == X) {
-				operand = RotateX(theta);
-			} else if(axis == Y) {
-				operand = RotateY(theta);
-			} else if(axis == Z) {
-				operand = RotateZ(theta);
+		// apply one pass of the compiled grammar to in, writing to out
+		// length is the predicted length of the result, so the output is
+		// allocated once at its exact size
+		// returns true if the pass changed anything
+		bool iterateTurtleString(CompiledGrammar::Pass pass, const string& in,
+				string& out, size_t length) {
+			const CompiledGrammar::Span* table = compiled->getTable(pass);
+			const char* arena = compiled->getArena();
+			out.assign(length, ' ');
+			char* write = &out[0];
+			bool changed = false;
+			for(string::const_iterator it = in.begin(); it != in.end(); ++it) {
+				const CompiledGrammar::Span& span = table[(unsigned char)*it];
+				write = std::copy(arena + span.offset, arena + span.offset + span.length, write);
+				changed = changed || !compiled->isIdentity(pass, *it);
 			}
-			ctm->top() *= operand;
+			return changed;
 		}
 
-		void turnAround() {
-			ensureCtm();
-			ctm->top() *= RotateY(180);
-		}
+		// apply one pass of the compiled grammar to in, writing to out, using
+		// worker threads - each worker measures its chunk's expanded length,
+		// an exclusive prefix sum over those gives every worker its offset in
+		// a single preallocated output string, then all workers write in place
+		// returns true if the pass changed anything
+		bool iterateTurtleStringParallel(CompiledGrammar::Pass pass, const string& in,
+				string& out, unsigned workers) {
+			const CompiledGrammar::Span* table = compiled->getTable(pass);
+			const char* arena = compiled->getArena();
+			size_t inLength = in.size();
+			size_t chunk = (inLength + workers - 1) / workers;
+			vector<size_t> offsets(workers + 1, 0);
+			vector<char> changed(workers, 0);
 
-		void forward() {
-			ensureCtm();
-			ctm->top() *= Translate(0, 0, segmentLength);
-		}
+			parallelFor(workers, [&](unsigned w) {
+				size_t begin = std::min(inLength, w * chunk);
+				size_t end = std::min(inLength, begin + chunk);
+				size_t length = 0;
+				bool chunkChanged = false;
+				for(size_t i = begin; i < end; i++) {
+					length += table[(unsigned char)in[i]].length;
+					chunkChanged = chunkChanged || !compiled->isIdentity(pass, in[i]);
+				}
+				offsets[w + 1] = length;
+				changed[w] = chunkChanged;
+			});
 
-		void push() {
-			ensureCtm();
-			ctm->push(ctm->top());
-		}
+			for(unsigned w = 0; w < workers; w++) {
+				offsets[w + 1] += offsets[w];
+			}
 
-		void pop() {
-			ensureCtm();
-			ctm->pop();
+			out.assign(offsets[workers], ' ');
+			parallelFor(workers, [&](unsigned w) {
+				size_t begin = std::min(inLength, w * chunk);
+				size_t end = std::min(inLength, begin + chunk);
+				char* write = &out[0] + offsets[w];
+				for(size_t i = begin; i < end; i++) {
+					const CompiledGrammar::Span& span = table[(unsigned char)in[i]];
+					write = std::copy(arena + span.offset, arena + span.offset + span.length, write);
+				}
+			});
+			return std::find(changed.begin(), changed.end(), 1) != changed.end();
 		}
-};
 
+		// run one pass on as many threads as it is worth, recording how long
+		// it took
+		bool runPass(CompiledGrammar::Pass pass, const string& in, string& out, size_t length) {
+			GenerationStats stats;
+			stats.seconds = secondsNow();
+			bool changed;
+			if(parallelThreshold != 0 && workers > 1 && in.size() >= parallelThreshold) {
+				changed = iterateTurtleStringParallel(pass, in, out, workers);
+			} else {
+				changed = iterateTurtleString(pass, in, out, length);
+			}
+			stats.seconds = secondsNow() - stats.seconds;
+			stats.bytes = out.size();
+			derivationStats.push_back(stats);
+			return changed;
+		}
 
-class LSystem {
-	private:
-		string name;
-		map<char, char> replacements;
-		map<char, string> grammar;
-		string turtleString;
-
-		// apply rules to turtleString one time
-		void iterateTurtleString() {
-			string nextTurtle = "";
-			for(string::iterator it = turtleString.begin(); it != turtleString.end(); ++it) {
-				char currentChar = *it;
-				map<char, string>::iterator rule = grammar.find(currentChar);
-				if(rule != grammar.end()) {
-					// if there is a rule for this character, replace with rhs
-					nextTurtle += rule->second;
-				} else {
-					// no rule, char is same in newTurtle
-					nextTurtle += currentChar;
-				}
+		// raw generation g, before replacements, derived from the latest
+		// checkpoint so each new generation is only one pass of work
+		const string& getGeneration(unsigned g) {
+			if(generations.empty() || generations[0] != start) {
+				generations.clear();
+				generations.push_back(start);
+				fixedPoint = false;
 			}
-			turtleString = nextTurtle;
-		}
-
-		// replace characters in turtleString according to replacements map
-		void applyReplacements() {
-			string repTurtle = "";
-			for(string::iterator it = turtleString.begin(); it != turtleString.end(); ++it) {
-				char currentChar = *it;
-				map<char, char>::iterator rep = replacements.find(currentChar);
-				if(rep != replacements.end()) {
-					// if there is a replacement for this character, replace
-					if(rep->second == ' ') {
-						// just remove character from string
-					} else {
-						repTurtle += rep->second;
-					}
+			while(generations.size() <= g && !fixedPoint) {
+				size_t length = compiled->predict(start, generations.size(), false).length;
+				string next;
+				if(runPass(CompiledGrammar::RULES, generations.back(), next, length)) {
+					generations.push_back(string());
+					generations.back().swap(next);
 				} else {
-					// no replacement, char is same in repTurtle
-					repTurtle += currentChar;
+					fixedPoint = true; // every later generation is the same
 				}
 			}
-			turtleString = repTurtle;
+			return generations[std::min<size_t>(g, generations.size() - 1)];
 		}
 
 	public:
 		Turtle protoTurtle;
 		unsigned iterations;
 		string start;
+		// derive and interpret on worker threads once the string or program
+		// gets at least this long
+		// zero means always work on the calling thread
+		size_t parallelThreshold;
+		unsigned workers; // threads to derive and interpret with
+		// hand out symbols from the rope instead of a Cursor
+		bool useRope;
+		// most bytes getTurtleString may use, it refuses to derive past this
+		unsigned long long memoryBudget;
+
+		// output size and time taken for one generation of derivation
+		struct GenerationStats {
+			size_t bytes;
+			double seconds;
+		};
+		vector<GenerationStats> derivationStats; // from the last derivation
+
+		// copies the grammar and settings, but nothing derived from them
+		LSystem(const LSystem& other) : protoTurtle(other.protoTurtle) {
+			name = other.name;
+			replacements = other.replacements;
+			grammar = other.grammar;
+			turtleString = "";
+			turtleIterations = -1;
+			fixedPoint = false;
+			compiled = NULL;
+			revision = 0;
+			rope = NULL;
+			program = NULL;
+			programIterations = -1;
+			instancer = NULL;
+			sizeIterations = -1;
+			cache = other.cache;
+			cachedHash = 0;
+			useRope = other.useRope;
+			iterations = other.iterations;
+			start = other.start;
+			parallelThreshold = other.parallelThreshold;
+			workers = other.workers;
+			memoryBudget = other.memoryBudget;
+		}
+
+		~LSystem() {
+			delete instancer;
+			delete program;
+			delete rope;
+			delete compiled;
+		}
 
 		LSystem(string name) {
 			this->name = name;
+			compiled = NULL;
+			revision = 0;
+			rope = NULL;
+			program = NULL;
+			programIterations = -1;
+			instancer = NULL;
+			sizeIterations = -1;
+			cache = NULL;
+			cachedHash = 0;
+			useRope = false;
 			turtleString = "";
+			turtleIterations = -1;
+			fixedPoint = false;
 			start = "";
 			iterations = 0;
+			parallelThreshold = 1 << 16;
+			workers = workerCount();
+			memoryBudget = 256 << 20;
 		}
 
 		string getName() {
@@ -149,39 +254,337 @@ class LSystem {
 		// add a replacement rule - use space for empty replacements
 		void addReplacement(char target, char replacement) {
 			replacements.insert(pair<char, char>(target, replacement));
+			forgetCompiledGrammar();
 		}
 
 		// add a rule to this lsystem's grammar
 		void addRule(char lhs, string rhs) {
 			grammar.insert(pair<char, string>(lhs, rhs));
+			forgetCompiledGrammar();
+		}
+
+		// rules and replacements compiled into lookup tables, built on demand
+		const CompiledGrammar* getCompiledGrammar() {
+			if(compiled == NULL) {
+				compiled = new CompiledGrammar(grammar, replacements);
+			}
+			return compiled;
+		}
+
+		// must be called whenever the rules or replacements change
+		void forgetCompiledGrammar() {
+			releaseDerived();
+			delete compiled;
+			compiled = NULL;
+			revision++;
+		}
+
+		// free the turtle string, rope, program and instancer, which are
+		// derived again if they're asked for
+		void releaseDerived() {
+			delete instancer;
+			instancer = NULL;
+			delete program;
+			program = NULL;
+			delete rope;
+			rope = NULL;
+			cached.close();
+			clearTurtleString();
+		}
+
+		// look for and save derived turtle strings in cache, may be NULL
+		void setCache(TurtleCache* cache) {
+			this->cache = cache;
+			this->cached.close();
+		}
+
+		// hash of everything that determines the turtle string
+		unsigned long long getGrammarHash() {
+			unsigned long long hash = TurtleCache::hashString(start);
+			char iter[16];
+			sprintf(iter, "%u", iterations);
+			hash = TurtleCache::hashString(iter, hash);
+			for(map<char, string>::const_iterator i = grammar.begin(); i != grammar.end(); ++i) {
+				hash = TurtleCache::hashString(string(1, i->first) + i->second, hash);
+			}
+			hash = TurtleCache::hashString("rep", hash);
+			for(map<char, char>::const_iterator i = replacements.begin(); i != replacements.end(); ++i) {
+				hash = TurtleCache::hashString(string(1, i->first) + i->second, hash);
+			}
+			return hash;
+		}
+
+		// size of the turtle string after iter iterations, without deriving it
+		CompiledGrammar::DerivationSize predictSize(unsigned iter) {
+			if(iter != iterations) {
+				return getCompiledGrammar()->predict(start, iter, true);
+			}
+			// asked for every frame, so remember the current one
+			if(sizeIterations != (int)iter || sizeStart != start || compiled == NULL) {
+				size = getCompiledGrammar()->predict(start, iter, true);
+				sizeIterations = iter;
+				sizeStart = start;
+			}
+			return size;
+		}
+
+		// most bytes getTurtleString will hold at once - every checkpointed
+		// generation plus the finished string
+		unsigned long long predictPeakBytes() {
+			return predictPeakBytes(iterations);
+		}
+
+		// the same for iter iterations, without changing iterations
+		unsigned long long predictPeakBytes(unsigned iter) {
+			const CompiledGrammar* grammar = getCompiledGrammar();
+			unsigned long long total = 0;
+			for(unsigned i = 0; i < iter; i++) {
+				total = CompiledGrammar::saturatingAdd(total, grammar->predict(start, i, false).length);
+			}
+			return CompiledGrammar::saturatingAdd(total, predictSize(iter).length);
+		}
+
+		// true if the turtle string can be derived within memoryBudget
+		// if not, use a Cursor to stream it instead
+		bool fitsMemoryBudget() {
+			return fitsMemoryBudget(iterations);
+		}
+
+		// true if it could be derived within memoryBudget after iter iterations
+		bool fitsMemoryBudget(unsigned iter) {
+			return predictPeakBytes(iter) <= memoryBudget;
+		}
+
+		// throw away the generated turtle string and checkpoints so it is
+		// derived again from scratch
+		void clearTurtleString() {
+			turtleString = "";
+			turtleIterations = -1;
+			generations.clear();
+		}
+
+		// change the number of iterations, reusing derived generations
+		void setIterations(unsigned iterations) {
+			this->iterations = iterations;
+			revision++;
+		}
+
+		// changes whenever the rules or iterations are changed through
+		// this class, so anything built from the turtle string can tell
+		// when it's out of date
+		unsigned getRevision() {
+			return revision;
 		}
 
 		// get the generated turtle string
+		// generations are kept as checkpoints, so after changing iterations
+		// this only has to derive the generations it hasn't seen yet
 		string getTurtleString() {
-			if(turtleString != "") { // already computed
+			if(turtleIterations == (int)iterations) { // already computed
 				return turtleString;
 			}
 			if(start == "") {
 				throw runtime_error("Empty start string");
 			}
 
-			turtleString = start;
-			string lastTurtle;
-			unsigned i = 0;
-			while(i < iterations) {
-				lastTurtle = turtleString;
-				iterateTurtleString();
-				if(turtleString == lastTurtle) {
-					break; // no longer changing
-				}
-				i++;
+			if(loadCached()) {
+				turtleString.assign(TurtleCache::getTurtleData(cached),
+					TurtleCache::getTurtleLength(cached));
+				turtleIterations = iterations;
+				return turtleString;
+			}
+			if(!fitsMemoryBudget()) {
+				throw runtime_error("Deriving " + name + " would exceed the memory budget");
+			}
+
+			getCompiledGrammar();
+			derivationStats.clear();
+			size_t length = predictSize(iterations).length;
+			if(iterations == 0) {
+				runPass(CompiledGrammar::REPLACEMENTS, start, turtleString, length);
+			} else {
+				// the replacements are folded into the last generation's rules
+				runPass(CompiledGrammar::FINAL, getGeneration(iterations - 1), turtleString, length);
+			}
+			turtleIterations = iterations;
+			if(cache != NULL) {
+				cache->store(getGrammarHash(), turtleString);
 			}
-			applyReplacements();
 			return turtleString;
 		}
 
+		// walks the derived turtle string depth-first, one symbol at a time,
+		// without ever building it - keeps one frame per generation, so
+		// memory use is O(iterations) instead of O(string length)
+		class Cursor : public TurtleSource {
+			private:
+				struct Frame {
+					const char* symbols;
+					unsigned length;
+					unsigned position;
+					unsigned depth;
+				};
+
+				const CompiledGrammar* compiled;
+				unsigned iterations;
+				string start;
+				vector<Frame> frames;
+
+				void pushFrame(const char* symbols, unsigned length, unsigned depth) {
+					Frame frame;
+					frame.symbols = symbols;
+					frame.length = length;
+					frame.position = 0;
+					frame.depth = depth;
+					frames.push_back(frame);
+				}
+
+			public:
+				Cursor(LSystem* lsys) {
+					if(lsys->start == "") {
+						throw runtime_error("Empty start string");
+					}
+					compiled = lsys->getCompiledGrammar();
+					iterations = lsys->iterations;
+					start = lsys->start;
+					if(iterations == 0) {
+						// nothing gets expanded, so replace up front
+						string replaced = "";
+						for(string::iterator it = start.begin(); it != start.end(); ++it) {
+							replaced.append(compiled->getExpansion(CompiledGrammar::REPLACEMENTS, *it),
+								compiled->getExpansionLength(CompiledGrammar::REPLACEMENTS, *it));
+						}
+						start = replaced;
+					}
+					frames.reserve(iterations + 1);
+					reset();
+				}
+
+				// go back to the first symbol of the derivation
+				void reset() {
+					frames.clear();
+					pushFrame(start.data(), start.size(), 0);
+				}
+
+				// put the next symbol in the derivation into symbol
+				// returns false once the derivation is exhausted
+				bool next(char& symbol) {
+					while(!frames.empty()) {
+						Frame& top = frames.back();
+						if(top.position == top.length) {
+							frames.pop_back();
+							continue;
+						}
+						char currentChar = top.symbols[top.position];
+						top.position++;
+
+						if(top.depth == iterations) {
+							// fully derived, replacements already applied
+							symbol = currentChar;
+							return true;
+						}
+
+						// symbols without rules skip straight to the last generation
+						if(compiled->isIdentity(CompiledGrammar::RULES, currentChar)) {
+							if(compiled->isIdentity(CompiledGrammar::FINAL, currentChar)) {
+								symbol = currentChar;
+								return true;
+							}
+							pushFrame(compiled->getExpansion(CompiledGrammar::FINAL, currentChar),
+								compiled->getExpansionLength(CompiledGrammar::FINAL, currentChar), iterations);
+							continue;
+						}
+
+						// expand the rhs one generation deeper, folding in
+						// the replacements on the last generation
+						// top is invalidated by this push
+						CompiledGrammar::Pass pass = top.depth + 1 == iterations
+							? CompiledGrammar::FINAL : CompiledGrammar::RULES;
+						pushFrame(compiled->getExpansion(pass, currentChar),
+							compiled->getExpansionLength(pass, currentChar), top.depth + 1);
+					}
+					return false;
+				}
+		};
+
+		// get a cursor over the turtle string that never materializes it
+		// caller is responsible for freeing memory
+		Cursor* getCursor() {
+			return new Cursor(this);
+		}
+
+		// the turtle string as a rope of shared expansions, built on demand
+		TurtleRope* getRope() {
+			if(rope != NULL && rope->getIterations() != iterations) {
+				delete instancer;
+				instancer = NULL;
+				delete rope;
+				rope = NULL;
+			}
+			if(rope == NULL) {
+				if(start == "") {
+					throw runtime_error("Empty start string");
+				}
+				rope = new TurtleRope(getCompiledGrammar(), start, iterations);
+			}
+			return rope;
+		}
+
+		// something to read the turtle string from without deriving all of it
+		// caller is responsible for freeing memory
+		TurtleSource* getTurtleSource() {
+			if(cache != NULL) {
+				if(!loadCached() && fitsMemoryBudget()) {
+					getTurtleString(); // derive once so it's cached next run
+				}
+				if(loadCached()) {
+					return new StringSource(TurtleCache::getTurtleData(cached),
+						TurtleCache::getTurtleLength(cached));
+				}
+			}
+			if(useRope) {
+				return getRope()->getIterator();
+			}
+			return getCursor();
+		}
+
+		// the turtle string compiled into optimized commands, built on demand
+		// returns NULL if the program wouldn't fit in the memory budget,
+		// in which case read symbols from getTurtleSource instead
+		TurtleProgram* getProgram() {
+			if(program != NULL && programIterations == (int)iterations) {
+				return program;
+			}
+			delete program;
+			program = NULL;
+			// divide rather than multiply, a saturated length would wrap
+			if(predictSize(iterations).length > memoryBudget / sizeof(TurtleProgram::Command)) {
+				return NULL;
+			}
+			TurtleSource* source = getTurtleSource();
+			program = new TurtleProgram(source, &protoTurtle);
+			programIterations = iterations;
+			delete source;
+			return program;
+		}
+
+		// every repeated subtree of the turtle string interpreted once,
+		// built on demand from the rope
+		// returns NULL if the string pops more than it pushes
+		SubtreeInstancer* getInstancer() {
+			TurtleRope* current = getRope(); // drops a stale instancer
+			if(instancer == NULL) {
+				instancer = new SubtreeInstancer(current, &protoTurtle);
+			}
+			return instancer->isUsable() ? instancer : NULL;
+		}
+
+		// a turtle with room for every push the turtle string makes
 		Turtle* getTurtleCopy() {
-			return new Turtle(protoTurtle);
+			Turtle* turtle = new Turtle(protoTurtle);
+			long long maxDepth = predictSize(iterations).maxDepth;
+			turtle->reserveDepth((unsigned)std::min(maxDepth, 1LL << 16));
+			return turtle;
 		}
 
 		void print() {
@@ -199,8 +602,16 @@ class LSystem {
 			for (map<char, string>::const_iterator i = grammar.begin(); i != grammar.end(); ++i) {
 				cout << i->first << " -> " << i->second << ", ";
 			}
+			CompiledGrammar::DerivationSize size = predictSize(iterations);
 			cout << "), " << endl <<
-				"turtleString=" << getTurtleString() << endl;
+				"length=" << size.length << ", " << endl <<
+				"segments=" << size.segments << ", " << endl <<
+				"maxDepth=" << size.maxDepth << ", " << endl;
+			if(fitsMemoryBudget()) {
+				cout << "turtleString=" << getTurtleString() << endl;
+			} else {
+				cout << "turtleString too big to print" << endl;
+			}
 		}
 
 };
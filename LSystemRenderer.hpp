@@ -6,7 +6,10 @@
 #include <stdlib.h>
 
 #include "LSystem.hpp"
-#include "PLYReader.hpp"
+#include "ShaderProgram.hpp"
+#include "BranchBounds.hpp"
+#include "MeshGenerator.hpp"
+#include "Forest.hpp"
 
 using std::vector;
 
@@ -14,46 +17,131 @@ using std::vector;
 
 class LSystemRenderer {
 	private:
-		GLuint program;
+		ShaderProgram* program;
+		// looked up once when the renderer is made
+		GLint modelLoc;
+		GLint colorLoc;
+		GLint instancedLoc;
+		GLint instanceMatrixLoc;
 		vector<LSystem*>& allSystems;
-		vector<LSystem*> systemsToDraw;
-		vector<vec4> colors;
-		vector<vec4> startPoints;
-		vec4 randomRange[2];
+		vector<unsigned> systemsToDraw; // allSystems index of each system on show
+		Forest forest;
+		// forest cells are this wide, in world units
+		static const int forestCellSize = 16;
 
 		vector<Mesh*> meshes;
-		Mesh* sphere;
-		GLsizeiptr sphereLength;
-		Mesh* cylinder;
-		GLsizeiptr cylinderLength;
+		Mesh* sphere;   // joints, full detail
+		Mesh* cylinder; // segments, full detail
+
+
+		// segment transforms for one system standing at the origin,
+		// interpreted once and shared by every tree of that system until
+		// the system or its iterations change
+		struct TreeGeometry {
+			LSystem* sys;
+			bool ownsSystem; // sys is a copy made for this geometry
+			unsigned iterations;
+			unsigned revision;
+			bool valid;
+			vector<mat4> joints;   // model matrix of each sphere
+			vector<mat4> segments; // model matrix of each cylinder
+			GLuint instanceBuffer; // joints then segments, 0 if not uploaded
+			Mesh* baked; // whole tree pretransformed into one mesh, or NULL
+			BranchBounds bounds; // for culling branches out of view
+			// the same tree i + 1 generations short and scaled up to the
+			// same size, for when it's small on screen, or NULL
+			vector<TreeGeometry*> coarser;
+			// a generation short it has the same proportions, so coarser
+			// trees can stand in for it without changing shape
+			// only known once shapeChecked
+			bool keepsShape;
+			bool shapeChecked;
+		};
+
+		// how much of a tree to draw, picked every frame from its size on screen
+		struct DetailLevel {
+			Mesh* joint;   // NULL to leave joints out
+			Mesh* segment;
+			unsigned droppedGenerations;
+		};
+		vector<TreeGeometry> trees; // one per entry of allSystems
+		bool instancing; // draw each tree with two instanced calls
+		bool baking; // draw each tree as one pretransformed mesh
+		bool meshesChanged; // baked meshes came or went since last buffered
+
+		// branches smaller than this are culled along with their parent
+		static const unsigned minBranchSegments = 32;
+		// when a draw call covers many segments, gaps shorter than this
+		// are cheaper to draw than to split the call around
+		static const unsigned minCulledRun = 256;
+		vector<BranchBounds::Range> visibleRanges; // reused every draw
+		unsigned long long culledSegments; // this frame
+		unsigned culledTrees; // this frame
+
+		// level of detail, meshes go from coarsest to full detail
+		bool levelOfDetail;
+		vector<Mesh*> jointLevels;
+		vector<Mesh*> segmentLevels;
+		vec3 eye;            // camera position
+		float pixelsPerUnit; // on screen size of 1 unit seen from 1 unit away
+		// full meshes for segments at least this many pixels thick,
+		// no joints at all below jointPixels
+		static const int fullDetailPixels = 4;
+		static const int jointPixels = 1;
+		// trees shorter than this on screen lose generations
+		static const int coarseTreePixels = 128;
+
+		// the generated meshes are a unit across, a sphere centered where
+		// the turtle is and a cylinder running from there along the
+		// heading, so placing them is only a matter of scaling
+		static mat4 jointScale(const Turtle* turtle) {
+			return Scale(turtle->thickness, turtle->thickness, turtle->thickness);
+		}
 
+		static mat4 segmentScale(const Turtle* turtle) {
+			return Scale(turtle->thickness, turtle->thickness, turtle->segmentLength);
+		}
 
-		// draw a component of a turtle (sphere or cylinder)
-		void drawTurtleComponent(Turtle* turtle, Mesh* comp) {
-			bool isCylinder = comp == cylinder;
-			vec3 size = comp->getBoundingBox()->getSize();
+		// draw a component with the given model matrix
+		void drawComponent(const mat4& model, Mesh* comp) {
+			program->setUniform(modelLoc, model);
 
-			// want to scale the cylinder to be segmentLength long, thin
-			// sphere is scaled uniformly
-			float thickRatio = turtle->thickness / size.y;
-			float zTarget = isCylinder ? turtle->segmentLength
-			                           : turtle->thickness;
-			mat4 scale = Scale(thickRatio, thickRatio, zTarget / size.z);
+			// draw the component
+			program->setPositionDecode(comp->getPositionScale(), comp->getPositionOffset());
+			program->drawElements(GL_TRIANGLES, comp->getNumIndices(), comp->getIndexType(),
+				comp->getIndexOffset(), comp->getDrawOffset());
+		}
 
-			vec4 center = comp->getBoundingBox()->getCenter();
-			// move cylinder so its end is flush with the yz plane
-			vec4 dest = vec4(0, 0, size.z/2, 1);
-			if(!isCylinder) {
-				dest.z = 0; // sphere intersects plane
+		// draw count copies of a component in one call, taking each copy's
+		// model matrix from buffer starting at offset
+		void drawInstances(GLuint buffer, GLsizeiptr offset, Mesh* comp, unsigned count) {
+			GLint previous;
+			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			// a mat4 attribute takes up four locations, one per row
+			GLuint matrixLoc = instanceMatrixLoc;
+			for(int row = 0; row < 4; row++) {
+				glEnableVertexAttribArray(matrixLoc + row);
+				glVertexAttribPointer(matrixLoc + row, 4, GL_FLOAT, GL_FALSE, sizeof(mat4),
+						BUFFER_OFFSET(offset + row * sizeof(vec4)));
+				glVertexAttribDivisor(matrixLoc + row, 1);
 			}
-			mat4 trans = Translate(dest - center);
+			glBindBuffer(GL_ARRAY_BUFFER, previous);
+			program->countCalls(3 + 4 * 3);
 
-			mat4 finalModel = turtle->ctm->top() * scale * trans;
-			GLuint modelLoc = glGetUniformLocationARB(program, "model_matrix");
-			glUniformMatrix4fv(modelLoc, 1, GL_TRUE, finalModel);
+			program->setPositionDecode(comp->getPositionScale(), comp->getPositionOffset());
+			program->drawElementsInstanced(GL_TRIANGLES, comp->getNumIndices(), comp->getIndexType(),
+				comp->getIndexOffset(), comp->getDrawOffset(), count);
 
-			// draw the component
-			glDrawArrays(GL_TRIANGLES, comp->getDrawOffset(), comp->getNumPoints());
+			for(int row = 0; row < 4; row++) {
+				glDisableVertexAttribArray(matrixLoc + row);
+			}
+			program->countCalls(4);
+		}
+
+		// draw a component of a turtle, scaled to size by scale
+		void drawTurtleComponent(Turtle* turtle, Mesh* comp, const mat4& scale) {
+			drawComponent(turtle->getTransform() * scale, comp);
 		}
 
 		vec4 randomColor() {
@@ -64,35 +152,15 @@ class LSystemRenderer {
 			return color;
 		}
 
-		// return a random point in the rectangle defined by randomRange
-		vec4 randomPoint() {
-			vec4 point(0, 0, 0, 1);
-			for(int i = 0; i < 3; i++) {
-				float lower = randomRange[0][i];
-				float upper = randomRange[1][i];
-				point[i] = lower + (float)rand() / ((float)RAND_MAX / (upper - lower));
-			}
-			return point;
-		}
-
-		// draw the given lsystem starting at the given position
-		void drawSystem(LSystem* sys, vec4 startPoint, vec4 color) {
-			Turtle* turtle = sys->getTurtleCopy();
-			stack<mat4> modelView;
-			// move to start point and point the tree upwards
-			modelView.push(Translate(startPoint) * RotateX(-90));
-			turtle->ctm = &modelView;
-			string turtleString = sys->getTurtleString();
-
-			GLuint colorLoc = glGetUniformLocationARB(program, "inColor");
-			glUniform4fv(colorLoc, 1, color);
-
-			for(string::iterator it = turtleString.begin(); it != turtleString.end(); ++it) {
-				char currentChar = *it;
-				
+		// draw by following every symbol of a turtle string
+		void drawSymbols(Turtle* turtle, TurtleSource* source) {
+			mat4 joint = jointScale(turtle);
+			mat4 segment = segmentScale(turtle);
+			char currentChar;
+			while(source->next(currentChar)) {
 				if(currentChar == 'F') {
-					drawTurtleComponent(turtle, sphere);
-					drawTurtleComponent(turtle, cylinder);
+					drawTurtleComponent(turtle, sphere, joint);
+					drawTurtleComponent(turtle, cylinder, segment);
 				}
 
 				switch(currentChar) {
@@ -129,70 +197,611 @@ class LSystemRenderer {
 						break;
 				}
 			}
+		}
+
+		// records a joint and a segment wherever the turtle program says to
+		// each segment has its own slot, so threads can record at once
+		struct SegmentRecorder {
+			TreeGeometry* tree;
+			mat4 jointTransform;
+			mat4 segmentTransform;
+
+			void operator()(const TurtleState& state, size_t segment) {
+				mat4 model = stateTransform(state);
+				tree->joints[segment] = model * jointTransform;
+				tree->segments[segment] = model * segmentTransform;
+			}
+
+			void operator()(Turtle* turtle, size_t segment) {
+				(*this)(turtle->getState(), segment);
+			}
+		};
+
+		// true if tree holds the current geometry of sys
+		bool isCurrent(const TreeGeometry& tree, LSystem* sys) {
+			return tree.valid && tree.sys == sys && tree.iterations == sys->iterations
+				&& tree.revision == sys->getRevision();
+		}
+
+		// free the GL buffer belonging to tree
+		void releaseTree(TreeGeometry& tree) {
+			if(tree.instanceBuffer != 0) {
+				glDeleteBuffers(1, &tree.instanceBuffer);
+				tree.instanceBuffer = 0;
+			}
+			if(tree.baked != NULL) {
+				meshes.erase(std::find(meshes.begin(), meshes.end(), tree.baked));
+				delete tree.baked;
+				tree.baked = NULL;
+				meshesChanged = true;
+			}
+			for(unsigned i = 0; i < tree.coarser.size(); i++) {
+				if(tree.coarser[i] != NULL) {
+					releaseTree(*tree.coarser[i]);
+					delete tree.coarser[i]->sys;
+					delete tree.coarser[i];
+				}
+			}
+			tree.coarser.clear();
+			tree.valid = false;
+		}
+
+		static TreeGeometry emptyTree() {
+			TreeGeometry empty;
+			empty.sys = NULL;
+			empty.ownsSystem = false;
+			empty.keepsShape = false;
+			empty.shapeChecked = false;
+			empty.valid = false;
+			empty.instanceBuffer = 0;
+			empty.baked = NULL;
+			return empty;
+		}
+
+		// put tree's matrices in a buffer of their own for instancing
+		void uploadTree(TreeGeometry& tree) {
+			GLsizeiptr bytes = tree.segments.size() * sizeof(mat4);
+			if(bytes == 0) {
+				return;
+			}
+			GLint previous;
+			glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous);
+			glGenBuffers(1, &tree.instanceBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, tree.instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, 2 * bytes, NULL, GL_STATIC_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &tree.joints[0]);
+			glBufferSubData(GL_ARRAY_BUFFER, bytes, bytes, &tree.segments[0]);
+			glBindBuffer(GL_ARRAY_BUFFER, previous);
+		}
+
+		// flatten tree into a single mesh by transforming a copy of the
+		// sphere and cylinder for every segment, split across threads
+		// the mesh isn't drawable until the scene buffers it
+		void bakeTree(TreeGeometry& tree) {
+			unsigned sphereVertices = sphere->getNumVertices();
+			unsigned sphereIndices = sphere->getNumIndices();
+			unsigned cylinderIndices = cylinder->getNumIndices();
+			unsigned perSegment = sphereVertices + cylinder->getNumVertices();
+			unsigned perSegmentIndices = sphereIndices + cylinderIndices;
+			unsigned count = tree.segments.size();
+			unsigned long long vertices = (unsigned long long)count * perSegment;
+			unsigned long long bytes = vertices * sizeof(vec3)
+				+ (unsigned long long)count * perSegmentIndices * sizeof(GLuint);
+			if(count == 0 || bytes > tree.sys->memoryBudget || vertices > 0xffffffffULL) {
+				return;
+			}
+
+			double bakeStart = secondsNow();
+			Mesh* baked = new Mesh(tree.sys->getName() + " (baked)", vertices);
+			baked->startFilling(count * perSegmentIndices / 3);
+			vec3* out = baked->getVertices();
+			const vec3* sphereVerts = sphere->getVertices();
+			const vec3* cylinderVerts = cylinder->getVertices();
+			unsigned workers = workerCount();
+			unsigned chunk = (count + workers - 1) / workers;
+			parallelFor(workers, [&](unsigned w) {
+				unsigned end = std::min(count, (w + 1) * chunk);
+				for(unsigned i = w * chunk; i < end; i++) {
+					unsigned first = i * perSegment;
+					for(unsigned v = 0; v < sphereVertices; v++) {
+						vec4 p = tree.joints[i] * vec4(sphereVerts[v]);
+						out[first + v] = vec3(p.x, p.y, p.z);
+					}
+					for(unsigned v = sphereVertices; v < perSegment; v++) {
+						vec4 p = tree.segments[i] * vec4(cylinderVerts[v - sphereVertices]);
+						out[first + v] = vec3(p.x, p.y, p.z);
+					}
+					unsigned firstIndex = i * perSegmentIndices;
+					for(unsigned p = 0; p < sphereIndices; p++) {
+						baked->setIndex(firstIndex + p, first + sphere->getIndex(p));
+					}
+					for(unsigned p = 0; p < cylinderIndices; p++) {
+						baked->setIndex(firstIndex + sphereIndices + p,
+							first + sphereVertices + cylinder->getIndex(p));
+					}
+				}
+			});
+			double bakeSeconds = secondsNow() - bakeStart;
+			bytes = baked->getNumHostBytes();
+
+			tree.baked = baked;
+			meshes.push_back(baked);
+			meshesChanged = true;
+			cout << baked->getName() << ": " << count << " segments in "
+				<< bakeSeconds * 1000 << " ms, " << bytes / 1024 << " KB of vertices and indices vs "
+				<< 2 * count * sizeof(mat4) / 1024 << " KB of instance matrices, "
+				<< "1 draw call vs 2 instanced or " << 2 * count << " per-segment" << endl;
+		}
+
+		// interpret sys into tree, returns false if it's too big to keep
+		bool buildTree(TreeGeometry& tree, LSystem* sys) {
+			releaseTree(tree);
+			tree.sys = sys;
+			tree.iterations = sys->iterations;
+			tree.revision = sys->getRevision();
+			tree.joints.clear();
+			tree.segments.clear();
+			tree.bounds.clear();
+			tree.valid = false;
+			tree.keepsShape = false;
+			tree.shapeChecked = false;
+
+			unsigned long long segments = sys->predictSize(sys->iterations).segments;
+			// divide rather than multiply, a saturated count would wrap
+			if(segments > sys->memoryBudget / (2 * sizeof(mat4))) {
+				return false;
+			}
+			// repeated subtrees are interpreted once and then placed,
+			// otherwise the whole program is interpreted
+			SubtreeInstancer* subtrees = sys->getInstancer();
+			TurtleProgram* turtleProgram = subtrees == NULL ? sys->getProgram() : NULL;
+			if(subtrees == NULL && turtleProgram == NULL) {
+				return false;
+			}
+
+			Turtle* turtle = sys->getTurtleCopy();
+			// point the tree upwards
+			turtle->start(RotateX(-90));
+			SegmentRecorder recorder;
+			recorder.tree = &tree;
+			recorder.jointTransform = jointScale(turtle);
+			recorder.segmentTransform = segmentScale(turtle);
+			unsigned long long count = subtrees != NULL ? subtrees->getNumSegments()
+				: turtleProgram->getStats().draws;
+			tree.joints.resize(count);
+			tree.segments.resize(count);
+			bool parallel = sys->parallelThreshold != 0 && count >= sys->parallelThreshold;
+			unsigned workers = parallel ? sys->workers : 1;
+			vector<BranchBounds::Range> branches;
+			if(subtrees != NULL) {
+				subtrees->runParallel(turtle->getState(), recorder, workers);
+				subtrees->printStats(sys->getName());
+				subtrees->getBranches(branches, minBranchSegments);
+			} else {
+				turtleProgram->runParallel(turtle, recorder, workers);
+				turtleProgram->getBranches(branches, minBranchSegments);
+			}
+			delete turtle;
+
+			BoundingBox* sphereBox = sphere->getBoundingBox();
+			BoundingBox* cylinderBox = cylinder->getBoundingBox();
+			tree.bounds.build(branches, count, [&](size_t i) {
+				Bounds bounds = Bounds::transformed(tree.joints[i],
+					sphereBox->getMin(), sphereBox->getMax());
+				bounds.add(Bounds::transformed(tree.segments[i],
+					cylinderBox->getMin(), cylinderBox->getMax()));
+				return bounds;
+			});
+
+			uploadTree(tree);
+			tree.valid = true;
+			return true;
+		}
+
+		// true if a and b have the same proportions and sit the same way
+		// about the origin, to within a tenth of their longest sides
+		static bool sameShape(const Bounds& a, const Bounds& b) {
+			float sideA = longestSide(a), sideB = longestSide(b);
+			if(sideA <= 0 || sideB <= 0) {
+				return false;
+			}
+			for(int i = 0; i < 3; i++) {
+				if(fabs(a.min[i] / sideA - b.min[i] / sideB) > 0.1f
+						|| fabs(a.max[i] / sideA - b.max[i] / sideB) > 0.1f) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static float longestSide(const Bounds& bounds) {
+			vec3 size = bounds.max - bounds.min;
+			return std::max(std::max(size.x, size.y), size.z);
+		}
+
+		// distance from the camera to the nearest point of bounds
+		float distanceFromEye(const Bounds& bounds) {
+			vec3 nearest;
+			for(int i = 0; i < 3; i++) {
+				nearest[i] = std::max(bounds.min[i], std::min(eye[i], bounds.max[i]));
+			}
+			return length(nearest - eye);
+		}
+
+		// pick meshes and derivation depth for tree from how big it looks
+		// from distance away
+		DetailLevel chooseDetail(TreeGeometry& tree, float distance) {
+			DetailLevel detail;
+			detail.joint = jointLevels.back();
+			detail.segment = segmentLevels.back();
+			detail.droppedGenerations = 0;
+			const Bounds& bounds = tree.bounds.getBounds();
+			if(!levelOfDetail || pixelsPerUnit <= 0 || bounds.empty || distance <= 0) {
+				return detail;
+			}
+			float thicknessPixels = tree.sys->protoTurtle.thickness * pixelsPerUnit / distance;
+			float treePixels = longestSide(bounds) * pixelsPerUnit / distance;
+
+			unsigned level = segmentLevels.size() - 1;
+			if(thicknessPixels < fullDetailPixels) {
+				level = thicknessPixels < jointPixels ? 0 : 1;
+			}
+			detail.segment = segmentLevels[level];
+			detail.joint = thicknessPixels < jointPixels ? NULL : jointLevels[level];
+			if(treePixels < coarseTreePixels && tree.iterations > 1 && !tree.shapeChecked) {
+				// most systems change shape from one generation to the next,
+				// so only drop generations from those that don't
+				tree.keepsShape = getCoarseTree(tree, 1) != NULL;
+				tree.shapeChecked = true;
+			}
+			if(treePixels < coarseTreePixels && tree.keepsShape) {
+				// about a generation less every time the tree halves in size
+				unsigned dropped = (unsigned)log2(coarseTreePixels / treePixels) + 1;
+				detail.droppedGenerations = std::min(dropped, tree.iterations - 1);
+			}
+			return detail;
+		}
+
+		// the same tree dropped generations short, scaled about the origin
+		// to be as big as tree, built the first time it's asked for
+		// NULL if it can't be built or isn't the same shape as tree
+		TreeGeometry* getCoarseTree(TreeGeometry& tree, unsigned dropped) {
+			if(tree.coarser.size() < dropped) {
+				tree.coarser.resize(dropped, NULL);
+			}
+			TreeGeometry*& coarse = tree.coarser[dropped - 1];
+			if(coarse != NULL) {
+				return coarse->valid ? coarse : NULL;
+			}
+			coarse = new TreeGeometry(emptyTree());
+			coarse->ownsSystem = true;
+			LSystem* sys = new LSystem(*tree.sys);
+			sys->setIterations(tree.iterations - dropped);
+			bool built = buildTree(*coarse, sys);
+			coarse->sys = sys;
+			sys->releaseDerived(); // only the matrices are needed from here on
+			if(!built || coarse->segments.empty()
+					|| !sameShape(coarse->bounds.getBounds(), tree.bounds.getBounds())) {
+				releaseTree(*coarse);
+				return NULL;
+			}
+
+			// a smaller copy of the same shape, so grow it to tree's size
+			float factor = longestSide(tree.bounds.getBounds()) / longestSide(coarse->bounds.getBounds());
+			mat4 grow = Scale(factor, factor, factor);
+			for(size_t i = 0; i < coarse->segments.size(); i++) {
+				coarse->joints[i] = grow * coarse->joints[i];
+				coarse->segments[i] = grow * coarse->segments[i];
+			}
+			coarse->bounds.scaleAbout(vec3(), factor);
+			glDeleteBuffers(1, &coarse->instanceBuffer);
+			coarse->instanceBuffer = 0;
+			uploadTree(*coarse);
+			return coarse;
+		}
+
+		// draw one tree of the forest, distance away from the camera
+		// its system's geometry is shared with every other tree of that
+		// system, and only the branches that might be in view are drawn,
+		// in as much detail as they look like they need
+		void drawForestTree(const ForestTree& placed, const mat4& projection, float distance) {
+			TreeGeometry& tree = trees[placed.system];
+			mat4 model = Translate(placed.position);
+			if(tree.valid) {
+				// cull in the tree's own space instead of moving its boxes
+				ViewFrustum frustum(projection * model);
+				DetailLevel detail = chooseDetail(tree, distance);
+				TreeGeometry* coarse = detail.droppedGenerations > 0
+					? getCoarseTree(tree, detail.droppedGenerations) : NULL;
+				if(!drawTree(coarse != NULL ? *coarse : tree, detail, placed.color, model, frustum)) {
+					culledTrees++;
+				}
+				return;
+			}
 
+			program->setUniform(colorLoc, placed.color);
+
+			// too big to keep, interpret the symbols as they stream in
+			LSystem* sys = allSystems[placed.system];
+			Turtle* turtle = sys->getTurtleCopy();
+			turtle->start(model * RotateX(-90));
+			TurtleSource* source = sys->getTurtleSource();
+			drawSymbols(turtle, source);
+			delete source;
 			delete turtle;
+		}
 
+		// draw the branches of tree that might be in view with detail's
+		// meshes, placed by model, returns false if none are
+		// only trees drawn in full detail get baked
+		bool drawTree(TreeGeometry& tree, const DetailLevel& detail, vec4 color, const mat4& model,
+				const ViewFrustum& frustum) {
+			unsigned count = tree.segments.size();
+			bool bake = baking && !tree.ownsSystem
+				&& detail.joint == sphere && detail.segment == cylinder;
+			bool batched = (bake && tree.baked != NULL) || (instancing && tree.instanceBuffer != 0);
+			size_t minGap = batched ? minCulledRun : 0;
+			size_t drawn = 0;
+			visibleRanges.clear();
+			auto visible = [&](size_t first, size_t last) {
+				if(!visibleRanges.empty() && first - visibleRanges.back().second < minGap) {
+					drawn += first - visibleRanges.back().second; // gap comes along
+					visibleRanges.back().second = last;
+				} else {
+					visibleRanges.push_back(BranchBounds::Range(first, last));
+				}
+				drawn += last - first;
+			};
+			tree.bounds.cull(frustum, visible);
+			culledSegments += count - drawn;
+			if(visibleRanges.empty()) {
+				return false;
+			}
+
+			program->setUniform(colorLoc, color);
+			if(bake && tree.baked == NULL) {
+				bakeTree(tree); // drawable once the scene rebuffers
+			}
+			if(bake && tree.baked != NULL && !meshesChanged) {
+				// segments were baked in order, each the same size
+				GLsizei perSegment = sphere->getNumIndices() + cylinder->getNumIndices();
+				GLsizeiptr indexSize = tree.baked->getIndexSize();
+				program->setUniform(modelLoc, model);
+				program->setPositionDecode(tree.baked->getPositionScale(), tree.baked->getPositionOffset());
+				for(unsigned i = 0; i < visibleRanges.size(); i++) {
+					const BranchBounds::Range& range = visibleRanges[i];
+					program->drawElements(GL_TRIANGLES, (range.second - range.first) * perSegment,
+						tree.baked->getIndexType(),
+						tree.baked->getIndexOffset() + range.first * perSegment * indexSize,
+						tree.baked->getDrawOffset());
+				}
+			} else if(instancing && tree.instanceBuffer != 0) {
+				// every joint in view in one call per range, then every segment
+				// the shader puts each instance's matrix after model
+				program->setUniform(modelLoc, model);
+				program->setUniform(instancedLoc, true);
+				for(unsigned i = 0; i < visibleRanges.size(); i++) {
+					const BranchBounds::Range& range = visibleRanges[i];
+					unsigned rangeCount = range.second - range.first;
+					if(detail.joint != NULL) {
+						drawInstances(tree.instanceBuffer, range.first * sizeof(mat4),
+							detail.joint, rangeCount);
+					}
+					drawInstances(tree.instanceBuffer, (count + range.first) * sizeof(mat4),
+						detail.segment, rangeCount);
+				}
+				program->setUniform(instancedLoc, false);
+			} else {
+				for(unsigned i = 0; i < visibleRanges.size(); i++) {
+					for(size_t j = visibleRanges[i].first; j < visibleRanges[i].second; j++) {
+						if(detail.joint != NULL) {
+							drawComponent(model * tree.joints[j], detail.joint);
+						}
+						drawComponent(model * tree.segments[j], detail.segment);
+					}
+				}
+			}
+			return true;
 		}
 
 	public:
-		LSystemRenderer(GLuint program, vector<LSystem*>& allSystems)
-				: allSystems(allSystems) {
+		LSystemRenderer(ShaderProgram* program, vector<LSystem*>& allSystems)
+				: allSystems(allSystems), forest(forestCellSize) {
 			this->program = program;
+			modelLoc = program->getUniform("model_matrix");
+			colorLoc = program->getUniform("inColor");
+			instancedLoc = program->getUniform("instanced");
+			instanceMatrixLoc = program->getAttribute("instance_matrix");
+			instancing = true;
+			baking = false;
+			meshesChanged = false;
+			culledSegments = 0;
+			culledTrees = 0;
+			levelOfDetail = true;
+			pixelsPerUnit = 0;
 			
-			PLYReader sphereReader("meshes/sphere.ply");
-			sphere = sphereReader.read();
-			PLYReader cylinderReader("meshes/cylinder.ply");
-			cylinder = cylinderReader.read();
-			meshes.push_back(cylinder);
-			meshes.push_back(sphere);
+			// coarsest first, all the same size so the same matrices
+			// place any of them
+			jointLevels.push_back(MeshGenerator::sphere("sphere (coarse)", 4, 2));
+			jointLevels.push_back(MeshGenerator::sphere("sphere (medium)", 8, 4));
+			jointLevels.push_back(MeshGenerator::sphere("sphere", 16, 10));
+			segmentLevels.push_back(MeshGenerator::cylinder("cylinder (coarse)", 4));
+			segmentLevels.push_back(MeshGenerator::cylinder("cylinder (medium)", 8));
+			segmentLevels.push_back(MeshGenerator::cylinder("cylinder", 16));
+			sphere = jointLevels.back();
+			cylinder = segmentLevels.back();
+			meshes.insert(meshes.end(), segmentLevels.begin(), segmentLevels.end());
+			meshes.insert(meshes.end(), jointLevels.begin(), jointLevels.end());
 			
 			showOneSystem(0);
 		}
 
-		void display() {
-			vec4 startPoint(0, 0, 0, 1);
-			for (vector<LSystem*>::const_iterator i = systemsToDraw.begin(); i != systemsToDraw.end(); ++i) {
-				int index = i - systemsToDraw.begin();
-				drawSystem(*i, startPoints[index], colors[index]);
+		// draw every tree on show, culling grid cells, trees and branches
+		// outside the view
+		// projection takes world space to clip space
+		void display(const mat4& projection) {
+			ViewFrustum frustum(projection);
+			culledSegments = 0;
+			culledTrees = 0;
+			if(trees.size() != allSystems.size()) {
+				trees.resize(allSystems.size(), emptyTree());
+			}
+
+			// build the systems on show first, so cells know how far
+			// their trees reach
+			// systems too big to keep have no bounds, so their trees are
+			// streamed wherever they are and the rest are culled without them
+			Bounds reach;
+			for(vector<unsigned>::const_iterator i = systemsToDraw.begin(); i != systemsToDraw.end(); ++i) {
+				TreeGeometry& tree = trees[*i];
+				if(isCurrent(tree, allSystems[*i]) || buildTree(tree, allSystems[*i])) {
+					reach.add(tree.bounds.getBounds());
+				}
+			}
+
+			for(unsigned cell = 0; cell < forest.getNumCells(); cell++) {
+				const unsigned* begin = forest.cellBegin(cell);
+				const unsigned* end = forest.cellEnd(cell);
+				if(begin == end) {
+					continue;
+				}
+				Bounds bounds = forest.getCellBounds(cell, reach);
+				bool outside = frustum.test(bounds) == ViewFrustum::OUTSIDE;
+				// every tree in the cell gets the detail of its nearest
+				float distance = bounds.empty ? 0 : distanceFromEye(bounds);
+				for(const unsigned* i = begin; i != end; ++i) {
+					const ForestTree& placed = forest.getTree(*i);
+					const TreeGeometry& tree = trees[placed.system];
+					if(!tree.valid) {
+						drawForestTree(placed, projection, 0);
+					} else if(outside) {
+						culledSegments += tree.segments.size();
+						culledTrees++;
+					} else {
+						drawForestTree(placed, projection, distance);
+					}
+				}
 			}
 		}
 
 		void showOneSystem(int index) {
 			systemsToDraw.clear();
-			systemsToDraw.push_back(allSystems[index]);
-			startPoints.clear();
-			startPoints.push_back(vec4(0, 0, 0, 1));
-			colors.clear();
-			colors.push_back(randomColor());
+			systemsToDraw.push_back(index);
+			forest.plantOne(index, vec3(), randomColor());
 		}
 
-		void showAllSystemsRandomly(vec4 min, vec4 max) {
-			randomRange[0] = min;
-			randomRange[1] = max;
+		// plant density trees per square unit of ground between min and
+		// max, of every system, the same forest for the same seed
+		void showForest(const vec3& min, const vec3& max, float density, unsigned long long seed) {
 			systemsToDraw.clear();
-			startPoints.clear();
-			colors.clear();
-			for (vector<LSystem*>::const_iterator sys = allSystems.begin(); sys != allSystems.end(); ++sys) {
-				systemsToDraw.push_back(*sys);
-				startPoints.push_back(randomPoint());
-				colors.push_back(randomColor());
+			for(unsigned i = 0; i < allSystems.size(); i++) {
+				systemsToDraw.push_back(i);
 			}
+			double plantStart = secondsNow();
+			forest.plant(min, max, density, allSystems.size(), seed);
+			cout << "forest: " << forest.size() << " trees in " << forest.getNumCells()
+				<< " cells, planted in " << (secondsNow() - plantStart) * 1000 << " ms" << endl;
 		}
 
-		bool forestMode() {
-			return systemsToDraw.size() > 1;
+		// add delta to the iterations of every system being shown
+		// won't go past what the memory budget allows
+		void stepIterations(int delta) {
+			for (vector<unsigned>::const_iterator i = systemsToDraw.begin(); i != systemsToDraw.end(); ++i) {
+				LSystem* sys = allSystems[*i];
+				unsigned newIterations = 0;
+				if(delta >= 0 || (unsigned)-delta <= sys->iterations) {
+					newIterations = sys->iterations + delta;
+				}
+				// check first, so a rejected step leaves the tree alone
+				if(newIterations != sys->iterations
+						&& (delta < 0 || sys->fitsMemoryBudget(newIterations))) {
+					sys->setIterations(newIterations);
+				}
+				cout << sys->getName() << " iter=" << sys->iterations << endl;
+			}
 		}
 
-		vector<Mesh*>* getMeshes() {
-			return &meshes;
+		// switch between instanced drawing and a draw call per component
+		void toggleInstancing() {
+			instancing = !instancing;
+			cout << getDrawModeName() << " drawing" << endl;
+		}
+
+		// switch between baked meshes and the other drawing modes
+		// throws the baked meshes away when switching off
+		void toggleBaking() {
+			baking = !baking;
+			if(!baking) {
+				for(vector<TreeGeometry>::iterator i = trees.begin(); i != trees.end(); ++i) {
+					if(i->baked != NULL) {
+						meshes.erase(std::find(meshes.begin(), meshes.end(), i->baked));
+						delete i->baked;
+						i->baked = NULL;
+						meshesChanged = true;
+					}
+				}
+			}
+			cout << getDrawModeName() << " drawing" << endl;
 		}
 
-		GLsizeiptr getTotalBytes() {
-			GLsizeiptr totalBytes = 0;
-			for (vector<Mesh*>::const_iterator i = meshes.begin(); i != meshes.end(); ++i) {
-				totalBytes += (*i)->getNumBytes();
+		string getDrawModeName() {
+			if(baking) {
+				return "baked";
 			}
-			return totalBytes;
+			return instancing ? "instanced" : "per-segment";
+		}
+
+		// true if meshes has changed since the last call
+		// the scene needs to buffer them again before they're drawn
+		bool takeMeshesChanged() {
+			bool changed = meshesChanged;
+			meshesChanged = false;
+			return changed;
+		}
+
+		// where the camera is, for picking how much detail to draw
+		// fovy is in degrees and screenHeight in pixels
+		void setCamera(const vec3& eye, float fovy, int screenHeight) {
+			this->eye = eye;
+			pixelsPerUnit = screenHeight / (2 * tan(fovy / 2 * M_PI / 180));
+		}
+
+		// switch between detail by distance and always full detail
+		void toggleLevelOfDetail() {
+			levelOfDetail = !levelOfDetail;
+			cout << "level of detail " << (levelOfDetail ? "on" : "off") << endl;
+		}
+
+		// stream trees too big to keep from each system's rope instead of
+		// expanding the grammar with a Cursor
+		void toggleRopeStreaming() {
+			bool useRope = allSystems.empty() || !allSystems[0]->useRope;
+			for(unsigned i = 0; i < allSystems.size(); i++) {
+				allSystems[i]->useRope = useRope;
+			}
+			cout << "streaming from " << (useRope ? "ropes" : "cursors") << endl;
+		}
+
+		// segments left out of the last frame for being out of view
+		unsigned long long getCulledSegments() {
+			return culledSegments;
+		}
+
+		// trees left out of the last frame for being out of view
+		unsigned getCulledTrees() {
+			return culledTrees;
+		}
+
+		unsigned getNumTrees() {
+			return forest.size();
+		}
+
+		bool forestMode() {
+			return forest.size() > 1;
+		}
+
+		vector<Mesh*>* getMeshes() {
+			return &meshes;
 		}
 
 };
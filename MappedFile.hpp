@@ -0,0 +1,111 @@
+
+#ifndef __MAPPEDFILE_H_
+#define __MAPPEDFILE_H_
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+	// no mmap, files are read into memory instead
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using std::string;
+
+// read-only view of a whole file's contents
+// mapped into memory where the platform allows, otherwise read in
+class MappedFile {
+	private:
+		const char* data;
+		size_t size;
+		bool mapped; // false if data was malloc'd
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+	public:
+		MappedFile() {
+			data = NULL;
+			size = 0;
+			mapped = false;
+		}
+
+		// returns false if the file couldn't be opened
+		bool open(const char* filename) {
+			close();
+#ifdef _WIN32
+			FILE* fp = fopen(filename, "rb");
+			if(fp == NULL) {
+				return false;
+			}
+			fseek(fp, 0, SEEK_END);
+			long count = ftell(fp);
+			rewind(fp);
+			char* buffer = (char*)malloc(count > 0 ? count : 1);
+			size = fread(buffer, 1, count > 0 ? count : 0, fp);
+			fclose(fp);
+			data = buffer;
+#else
+			int fd = ::open(filename, O_RDONLY);
+			if(fd < 0) {
+				return false;
+			}
+			struct stat info;
+			if(fstat(fd, &info) != 0) {
+				::close(fd);
+				return false;
+			}
+			size = info.st_size;
+			if(size == 0) {
+				::close(fd);
+				data = NULL;
+				return true;
+			}
+			void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd); // the mapping keeps its own reference
+			if(address == MAP_FAILED) {
+				size = 0;
+				return false;
+			}
+			data = (const char*)address;
+			mapped = true;
+#endif
+			return true;
+		}
+
+		void close() {
+			if(data != NULL) {
+#ifdef _WIN32
+				free((void*)data);
+#else
+				if(mapped) {
+					munmap((void*)data, size);
+				} else {
+					free((void*)data);
+				}
+#endif
+			}
+			data = NULL;
+			size = 0;
+			mapped = false;
+		}
+
+		const char* getData() const {
+			return data;
+		}
+
+		size_t getSize() const {
+			return size;
+		}
+
+		~MappedFile() {
+			close();
+		}
+};
+
+#endif
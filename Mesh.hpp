@@ -109,58 +109,60 @@ class BoundingBox {
 		}
 };
 
-// holds vertex list and point data to be sent to GPU
+// holds vertices and the triangles between them, as indices into the
+// vertices, to be sent to GPU
+// vertices are points, so only x, y and z are kept
+// indices are 16 bit when there are few enough vertices, otherwise 32 bit
 class Mesh {
 	private:
-		vec4* vertices;
-		vec4* points;
+		vec3* vertices;
+		unsigned numVertices; // room for
 		unsigned vertIndex;
-		unsigned pointIndex;
-		unsigned lineIndex;
-		unsigned numPoints;
-		unsigned numNormalLinePoints;
+		GLushort* shortIndices; // one of these two holds the indices
+		GLuint* intIndices;
+		unsigned numIndices;
+		unsigned indexIndex;
 		unsigned drawOffset; // for external use
-		vec4* normals;
+		GLsizeiptr indexOffset; // for external use
+		vec4 positionScale;  // for external use, see getPositionScale
+		vec4 positionOffset;
 		string name;
 		BoundingBox* box;
+		// only made when asked for
+		vec4* normals;
 		vec4* normalLines;
-		float maxSize;
-
-		// add 3 identical normal vectors to normals array using newell method
-		// also add line segments to normalLines
-		void addNormal(vec4 a, vec4 b, vec4 c) {
-			vec4 normal(0, 0, 0, 0);
-			// newell method
-			vec4 verts[3] = {a, b, c};
-			for(int i = 0; i < 3; i++) {
-				vec4 current = verts[i];
-				vec4 next = verts[(i + 1) % 3];
-				normal.x += (current.y - next.y)*(current.z + next.z);
-				normal.y += (current.z - next.z)*(current.x + next.x);
-				normal.z += (current.x - next.x)*(current.y + next.y);
-			}
-			normal = normalize(normal);
-			normals[pointIndex] = normals[pointIndex + 1] = normals[pointIndex + 2] = normal;
-			
-			// add a line to normalLines by finding center of face,
-			// adding a line through center along normal extending out by maxSize
-			if(maxSize == 0) {
-				maxSize = box->getMaxSize();
+
+		// the same normal at all three corners of each triangle, so
+		// triangles stay flat, using newell method
+		void makeNormals() {
+			normals = new vec4[numIndices];
+			for(unsigned t = 0; t < numIndices; t += 3) {
+				vec4 normal(0, 0, 0, 0);
+				for(int i = 0; i < 3; i++) {
+					vec3 current = vertices[getIndex(t + i)];
+					vec3 next = vertices[getIndex(t + (i + 1) % 3)];
+					normal.x += (current.y - next.y)*(current.z + next.z);
+					normal.y += (current.z - next.z)*(current.x + next.x);
+					normal.z += (current.x - next.x)*(current.y + next.y);
+				}
+				normals[t] = normals[t + 1] = normals[t + 2] = normalize(normal);
 			}
-			vec4 center = (a + b + c) / 3;
-			normalLines[lineIndex] = center;
-			normalLines[++lineIndex] = center + (maxSize/20 * normal);
-			lineIndex++;
 		}
-	
+
 	public:
 		Mesh(string _name, unsigned numVertices) {
 			name = _name;
-			vertices = new vec4[numVertices];
+			vertices = new vec3[numVertices];
+			this->numVertices = numVertices;
 			vertIndex = 0;
-			maxSize = 0;
+			shortIndices = NULL;
+			intIndices = NULL;
+			numIndices = indexIndex = 0;
+			drawOffset = indexOffset = 0;
+			positionScale = vec4(1, 1, 1, 0);
+			positionOffset = vec4(0, 0, 0, 0);
 			box = NULL;
-			normals = points = normalLines = NULL;
+			normals = normalLines = NULL;
 		}
 
 		string getName() {
@@ -168,7 +170,7 @@ class Mesh {
 		}
 
 		void addVertex(vec4 vert) {
-			vertices[vertIndex] = vert;
+			vertices[vertIndex] = vec3(vert.x, vert.y, vert.z);
 			vertIndex++;
 			if(box == NULL) {
 				box = new BoundingBox(vert);
@@ -177,49 +179,112 @@ class Mesh {
 		}
 
 		void startTriangles(unsigned numTriangles) {
-			numPoints = numTriangles * 3;
-			points = new vec4[numPoints];
-			normals = new vec4[numPoints];
-			numNormalLinePoints = numTriangles * 2; // two points per face
-			normalLines = new vec4[numNormalLinePoints];
-			pointIndex = 0;
-			lineIndex = 0;
+			numIndices = numTriangles * 3;
+			if(numVertices <= 0x10000) {
+				shortIndices = new GLushort[numIndices];
+			} else {
+				intIndices = new GLuint[numIndices];
+			}
+			indexIndex = 0;
+		}
+
+		// make room for every vertex and numTriangles triangles, filled in
+		// through getVertices and setIndex rather than added one by one,
+		// so several threads can fill in parts at once - no bounding box
+		void startFilling(unsigned numTriangles) {
+			vertIndex = numVertices;
+			startTriangles(numTriangles);
+			indexIndex = numIndices;
 		}
 
 		void addTriangle(unsigned a, unsigned b, unsigned c) {
-			unsigned origIndex = pointIndex;
-			points[pointIndex] = vertices[a]; pointIndex++;
-			points[pointIndex] = vertices[b]; pointIndex++;
-			points[pointIndex] = vertices[c];
-			pointIndex = origIndex;
-			addNormal(vertices[a], vertices[b], vertices[c]);
-			pointIndex = origIndex + 3;
+			setIndex(indexIndex++, a);
+			setIndex(indexIndex++, b);
+			setIndex(indexIndex++, c);
 		}
 
-		unsigned getNumPoints() {
-			return numPoints;
+		void setIndex(unsigned i, unsigned vertex) {
+			if(shortIndices != NULL) {
+				shortIndices[i] = vertex;
+			} else {
+				intIndices[i] = vertex;
+			}
 		}
 
-		unsigned getNumNormalLinePoints() {
-			return numNormalLinePoints;
+		unsigned getIndex(unsigned i) const {
+			return shortIndices != NULL ? shortIndices[i] : intIndices[i];
+		}
+
+		unsigned getNumVertices() {
+			return vertIndex;
+		}
+
+		vec3* getVertices() {
+			return vertices;
+		}
+
+		// three per triangle
+		unsigned getNumIndices() {
+			return numIndices;
+		}
+
+		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		GLenum getIndexType() {
+			return intIndices != NULL ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+		}
+
+		unsigned getIndexSize() {
+			return intIndices != NULL ? sizeof(GLuint) : sizeof(GLushort);
+		}
+
+		const GLvoid* getIndices() {
+			return intIndices != NULL ? (const GLvoid*)intIndices : (const GLvoid*)shortIndices;
 		}
 
+		// bytes of vertices
 		GLsizeiptr getNumBytes() {
-			return sizeof(points[0]) * numPoints;
+			return sizeof(vertices[0]) * vertIndex;
 		}
 
-		vec4* getPoints() {
-			return points;
+		GLsizeiptr getNumIndexBytes() {
+			return (GLsizeiptr)getIndexSize() * numIndices;
+		}
+
+		// what the mesh takes up in memory, not counting normals
+		GLsizeiptr getNumHostBytes() {
+			return sizeof(vertices[0]) * numVertices + getNumIndexBytes();
 		}
 
+		// a normal for every corner of every triangle, in index order
 		vec4* getNormals() {
+			if(normals == NULL) {
+				makeNormals();
+			}
 			return normals;
 		}
 
+		unsigned getNumNormalLinePoints() {
+			return numIndices / 3 * 2; // two points per face
+		}
+
+		// a line out of the center of every face along its normal, a
+		// twentieth as long as the mesh is big
 		vec4* getNormalLines() {
+			if(normalLines == NULL) {
+				vec4* cornerNormals = getNormals();
+				float lineLength = box == NULL ? 0 : box->getMaxSize() / 20;
+				normalLines = new vec4[getNumNormalLinePoints()];
+				for(unsigned t = 0; t < numIndices; t += 3) {
+					vec4 center = (vec4(vertices[getIndex(t)]) + vec4(vertices[getIndex(t + 1)])
+						+ vec4(vertices[getIndex(t + 2)])) / 3;
+					normalLines[t / 3 * 2] = center;
+					normalLines[t / 3 * 2 + 1] = center + lineLength * cornerNormals[t];
+				}
+			}
 			return normalLines;
 		}
 
+		// first vertex in a shared vertex buffer
 		unsigned getDrawOffset() {
 			return drawOffset;
 		}
@@ -228,18 +293,40 @@ class Mesh {
 			drawOffset = offset;
 		}
 
+		// byte offset of the first index in a shared index buffer
+		GLsizeiptr getIndexOffset() {
+			return indexOffset;
+		}
+
+		void setIndexOffset(GLsizeiptr offset) {
+			indexOffset = offset;
+		}
+
+		// what the vertex shader scales and then offsets positions by,
+		// when they're stored in a buffer in some smaller form
+		const vec4& getPositionScale() {
+			return positionScale;
+		}
+
+		const vec4& getPositionOffset() {
+			return positionOffset;
+		}
+
+		void setPositionDecode(const vec4& scale, const vec4& offset) {
+			positionScale = scale;
+			positionOffset = offset;
+		}
+
 		BoundingBox* getBoundingBox() {
 			return box;
 		}
 
 		~Mesh() {
-			delete vertices;
-			if(points != NULL) {
-				delete points;
-			}
-			if(normals != NULL) {
-				delete normals;
-			}
+			delete[] vertices;
+			delete[] shortIndices;
+			delete[] intIndices;
+			delete[] normals;
+			delete[] normalLines;
 			if(box != NULL) {
 				delete box;
 			}
@@ -0,0 +1,112 @@
+#ifndef __MESHGENERATOR_H_
+#define __MESHGENERATOR_H_
+
+#include <string>
+#include <cmath>
+
+#include "Angel.h"
+#include "Mesh.hpp"
+
+using std::string;
+
+// builds the primitives branches are drawn with in code, rather than
+// reading them from a file
+// everything is one unit across, around the z axis, so a turtle only has
+// to scale them by its thickness and segment length
+class MeshGenerator {
+	private:
+		// slices vertices around the z axis at height z
+		static void addRing(Mesh* mesh, unsigned slices, float radius, float z) {
+			for(unsigned i = 0; i < slices; i++) {
+				float angle = 2 * M_PI * i / slices;
+				mesh->addVertex(vec4(radius * cos(angle), radius * sin(angle), z, 1));
+			}
+		}
+
+		// join the ring starting at vertex a to the one above it at b,
+		// counterclockwise seen from outside
+		static void addBand(Mesh* mesh, unsigned a, unsigned b, unsigned slices) {
+			for(unsigned i = 0; i < slices; i++) {
+				unsigned next = (i + 1) % slices;
+				mesh->addTriangle(a + i, a + next, b + next);
+				mesh->addTriangle(a + i, b + next, b + i);
+			}
+		}
+
+		// close the ring starting at first with triangles to pole, which
+		// is above the ring if top
+		static void addFan(Mesh* mesh, unsigned pole, unsigned first, unsigned slices, bool top) {
+			for(unsigned i = 0; i < slices; i++) {
+				unsigned next = (i + 1) % slices;
+				if(top) {
+					mesh->addTriangle(pole, first + i, first + next);
+				} else {
+					mesh->addTriangle(pole, first + next, first + i);
+				}
+			}
+		}
+
+	public:
+		// closed cylinder one unit across with slices sides, from z = 0
+		// to z = 1
+		// caller is responsible for freeing memory
+		static Mesh* cylinder(string name, unsigned slices) {
+			Mesh* mesh = new Mesh(name, slices * 2 + 2);
+			addRing(mesh, slices, 0.5, 0);
+			addRing(mesh, slices, 0.5, 1);
+			unsigned bottom = slices * 2, top = slices * 2 + 1;
+			mesh->addVertex(vec4(0, 0, 0, 1));
+			mesh->addVertex(vec4(0, 0, 1, 1));
+
+			mesh->startTriangles(slices * 4);
+			addBand(mesh, 0, slices, slices);
+			addFan(mesh, bottom, 0, slices, false);
+			addFan(mesh, top, slices, slices, true);
+			return mesh;
+		}
+
+		// sphere one unit across centered on the origin, made of slices
+		// wedges around z and stacks bands from pole to pole
+		// stacks must be even and at least 2
+		// caller is responsible for freeing memory
+		static Mesh* sphere(string name, unsigned slices, unsigned stacks) {
+			return capsule(name, slices, stacks, 0);
+		}
+
+		// cylinder one unit across from z = 0 to z = length, with a half
+		// sphere on each end - a sphere when length is 0
+		// stacks counts the bands of both half spheres, must be even and
+		// at least 2
+		// caller is responsible for freeing memory
+		static Mesh* capsule(string name, unsigned slices, unsigned stacks, float length) {
+			unsigned capStacks = stacks / 2;
+			// rings from the bottom up, the two equators are the same
+			// ring when there's no length between them
+			unsigned rings = capStacks * 2 - (length == 0 ? 1 : 0);
+			Mesh* mesh = new Mesh(name, rings * slices + 2);
+			for(unsigned r = 1; r <= capStacks; r++) {
+				float polar = M_PI / 2 * r / capStacks; // from the south pole
+				addRing(mesh, slices, 0.5 * sin(polar), -0.5 * cos(polar));
+			}
+			if(length != 0) {
+				addRing(mesh, slices, 0.5, length);
+			}
+			for(unsigned r = capStacks - 1; r > 0; r--) {
+				float polar = M_PI / 2 * r / capStacks; // from the north pole
+				addRing(mesh, slices, 0.5 * sin(polar), length + 0.5 * cos(polar));
+			}
+			unsigned south = rings * slices, north = rings * slices + 1;
+			mesh->addVertex(vec4(0, 0, -0.5, 1));
+			mesh->addVertex(vec4(0, 0, length + 0.5, 1));
+
+			mesh->startTriangles(slices * 2 * rings);
+			addFan(mesh, south, 0, slices, false);
+			for(unsigned r = 0; r + 1 < rings; r++) {
+				addBand(mesh, r * slices, (r + 1) * slices, slices);
+			}
+			addFan(mesh, north, (rings - 1) * slices, slices, true);
+			return mesh;
+		}
+};
+
+#endif
@@ -6,6 +6,8 @@
 #include <algorithm>
 
 #include "Mesh.hpp"
+#include "ShaderProgram.hpp"
+#include "VertexFormat.hpp"
 
 using std::vector;
 using std::cout;
@@ -14,16 +16,26 @@ using std::endl;
 // renders a chosen mesh from a list of meshes
 class MeshRenderer {
 	private:
-		GLuint program;
+		ShaderProgram* program;
+		// looked up once when the renderer is made
+		GLint modelLoc;
+		GLint projectionLoc;
+		GLint scaleLoc;
+		GLint positionLoc;
+		GLint normalLoc;
 		vector<Mesh*> meshes; // all meshes this can render
 		unsigned currentMeshIndex;
 		Mesh* currentMesh;
 
 		GLsizeiptr meshLength;
 		GLsizeiptr boxLength;
-		GLsizeiptr normalLength;
 		GLsizeiptr lineLength;
-		GLsizeiptr triangleLength;
+
+		// how the buffer stores positions and normals
+		VertexFormat::Position positionFormat;
+		VertexFormat::Normal normalFormat;
+		vec4 positionScale;
+		vec4 positionOffset;
 		
 		mat4 modelView;
 		mat4 projection;
@@ -50,43 +62,51 @@ class MeshRenderer {
 			currentMeshIndex = index;
 			cout << currentMesh->getName() << endl;
 			
-			meshLength = currentMesh->getNumPoints();
-			vec4* meshPoints = currentMesh->getPoints();
-			GLsizeiptr meshBytes = sizeof(meshPoints[0]) * meshLength;
-			
+			meshLength = currentMesh->getNumIndices();
 			BoundingBox* box = currentMesh->getBoundingBox();
 			boxLength = box->getNumPoints();
-			vec4* boxPoints = box->getPoints();
-			GLsizeiptr boxBytes = sizeof(boxPoints[0]) * boxLength;
-
-			vec4* normals = currentMesh->getNormals();
-			normalLength = meshLength;
-			GLsizeiptr normalBytes = meshBytes;
-
-			vec4* lines = currentMesh->getNormalLines();
 			lineLength = currentMesh->getNumNormalLinePoints();
-			GLsizeiptr lineBytes = sizeof(lines[0]) * lineLength;
 
-			GLsizeiptr totalBytes = meshBytes + boxBytes + normalBytes + lineBytes;
-			glBufferData(GL_ARRAY_BUFFER, totalBytes, NULL, GL_STATIC_DRAW);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, meshBytes, meshPoints);
-			glBufferSubData(GL_ARRAY_BUFFER, meshBytes, boxBytes, boxPoints);
-			glBufferSubData(GL_ARRAY_BUFFER, meshBytes + boxBytes, normalBytes, normals);
-			glBufferSubData(GL_ARRAY_BUFFER, meshBytes + boxBytes + normalBytes, lineBytes, lines);
+			// every corner of the mesh's triangles, then the box, then the
+			// normal lines, all drawn from the same position array
+			// corners aren't shared, so each triangle gets its own flat normal
+			vector<vec3> positions;
+			vec3* vertices = currentMesh->getVertices();
+			for(GLsizeiptr i = 0; i < meshLength; i++) {
+				positions.push_back(vertices[currentMesh->getIndex(i)]);
+			}
+			vec4* boxPoints = box->getPoints();
+			vec4* lines = currentMesh->getNormalLines();
+			for(GLsizeiptr i = 0; i < boxLength; i++) {
+				positions.push_back(vec3(boxPoints[i].x, boxPoints[i].y, boxPoints[i].z));
+			}
+			for(GLsizeiptr i = 0; i < lineLength; i++) {
+				positions.push_back(vec3(lines[i].x, lines[i].y, lines[i].z));
+			}
+			// a normal for every position, only the mesh's are used
+			vector<vec4> normals(currentMesh->getNormals(), currentMesh->getNormals() + meshLength);
+			normals.resize(positions.size(), vec4(0, 0, 0, 0));
+
+			GLsizeiptr positionBytes = positions.size() * VertexFormat::stride(positionFormat);
+			GLsizeiptr normalBytes = normals.size() * VertexFormat::stride(normalFormat);
+			vector<char> packed(positionBytes + normalBytes);
+			VertexFormat::decoding(positionFormat, &positions[0], positions.size(),
+				positionScale, positionOffset);
+			VertexFormat::pack(positionFormat, &positions[0], positions.size(),
+				positionScale, positionOffset, &packed[0]);
+			VertexFormat::pack(normalFormat, &normals[0], normals.size(), &packed[positionBytes]);
+			glBufferData(GL_ARRAY_BUFFER, packed.size(), &packed[0], GL_STATIC_DRAW);
 
 			// set up vertex arrays
-			GLuint posLoc = glGetAttribLocation(program, "vPosition");
-			glEnableVertexAttribArray(posLoc);
-			glVertexAttribPointer(posLoc, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
-			
-			triangleLength = meshLength + boxLength;
-			GLsizeiptr normalOffset = triangleLength * sizeof(currentMesh->getPoints()[0]);
-
-			// set up normal array, which is after all triangles
-			GLuint normalLoc = glGetAttribLocation(program, "normal");
-			glEnableVertexAttribArray(normalLoc);
-			glVertexAttribPointer(normalLoc, 4, GL_FLOAT, GL_FALSE, 0,
-					BUFFER_OFFSET(normalOffset));
+			glEnableVertexAttribArray(positionLoc);
+			VertexFormat::setAttribute(positionFormat, positionLoc, 0);
+
+			// set up normal array, which is after all positions, if the
+			// shaders take normals
+			if(normalLoc >= 0) {
+				glEnableVertexAttribArray(normalLoc);
+				VertexFormat::setAttribute(normalFormat, normalLoc, positionBytes);
+			}
 
 			resetState();
 			glutPostRedisplay();
@@ -111,13 +131,20 @@ class MeshRenderer {
 
 
 	public:
-		MeshRenderer(vector<Mesh*> _meshes, GLuint _program) {
+		MeshRenderer(vector<Mesh*> _meshes, ShaderProgram* _program) {
 			meshes = _meshes;
 			program = _program;
+			modelLoc = program->getUniform("model_matrix");
+			projectionLoc = program->getUniform("projection_matrix");
+			scaleLoc = program->getUniform("normal_scale");
+			positionLoc = program->getAttribute("vPosition");
+			normalLoc = program->getAttribute("normal");
 			showBoundingBox = false;
 			breathe = false;
 			showNormals = false;
 			lastTicks = 0;
+			positionFormat = VertexFormat::FLOAT3;
+			normalFormat = VertexFormat::NORMAL_FLOAT4;
 			showMesh(0);
 		}
 
@@ -134,6 +161,14 @@ class MeshRenderer {
 			glutPostRedisplay();
 		}
 
+		// store the meshes' positions and normals in these formats from
+		// now on
+		void setVertexFormats(VertexFormat::Position positions, VertexFormat::Normal normals) {
+			positionFormat = positions;
+			normalFormat = normals;
+			showMesh(currentMeshIndex);
+		}
+
 		void showPrevMesh() {
 			if(currentMeshIndex == 0) {
 				showMesh(meshes.size() - 1);
@@ -202,24 +237,21 @@ class MeshRenderer {
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			
 			// hook up matrices with shader
-			GLuint modelLoc = glGetUniformLocationARB(program, "model_matrix");
-			glUniformMatrix4fv(modelLoc, 1, GL_TRUE, modelView);
-			GLuint projLoc = glGetUniformLocationARB(program, "projection_matrix");
-			glUniformMatrix4fv(projLoc, 1, GL_TRUE, projection);
-
-			GLuint scaleLoc = glGetUniformLocation(program, "normal_scale");
-			glUniform1f(scaleLoc, normalScale);
+			program->setUniform(modelLoc, modelView);
+			program->setUniform(projectionLoc, projection);
+			program->setUniform(scaleLoc, normalScale);
+			program->setPositionDecode(positionScale, positionOffset);
 
 			// draw triangles
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			glEnable(GL_DEPTH_TEST);
-			glDrawArrays(GL_TRIANGLES, 0, meshLength);
-			glUniform1f(scaleLoc, 0); // everything after this is unscaled
+			program->drawArrays(GL_TRIANGLES, 0, meshLength);
+			program->setUniform(scaleLoc, 0.0f); // everything after this is unscaled
 			if(showBoundingBox) {
-				glDrawArrays(GL_TRIANGLES, meshLength, boxLength);
+				program->drawArrays(GL_TRIANGLES, meshLength, boxLength);
 			}
 			if(showNormals) {
-				glDrawArrays(GL_LINES, meshLength + boxLength + normalLength, lineLength);
+				program->drawArrays(GL_LINES, meshLength + boxLength, lineLength);
 			}
 			glDisable(GL_DEPTH_TEST); 
 
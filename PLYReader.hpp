@@ -1,52 +1,658 @@
-
 #ifndef __PLYREADER_H_
 #define __PLYREADER_H_
 
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include "Mesh.hpp"
 #include "textfile.cpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
 #include "ReaderException.hpp"
 
 using std::string;
 using std::stringstream;
+using std::vector;
 using std::endl;
 using std::cout;
 
-// reads a PLY file
+// reads a PLY file, ascii or binary in either byte order
+// the file is mapped and scanned once, numbers are parsed straight out of
+// the mapping with nothing allocated per line
+// x, y and z of each vertex and triangles from the face element's
+// vertex_indices are read, any other elements and properties are skipped
 class PLYReader {
+	public:
+		enum Format { ASCII, BINARY_LITTLE_ENDIAN, BINARY_BIG_ENDIAN };
+		enum Type { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+		// a property line of the header
+		struct Property {
+			string name;
+			Type type;      // of the value, or of each list entry
+			bool list;
+			Type countType; // of a list's length
+		};
+
+		// an element line of the header and the properties after it
+		struct Element {
+			string name;
+			unsigned count;
+			vector<Property> properties;
+		};
+
 	private:
-		string content;
+		const char* filename;
+		Format format;
+		vector<Element> elements;
+		// where the scan is up to
+		const char* pos;
+		const char* end;
+		unsigned lineNum;
+		const char* body; // start of a binary body, there are no lines in one
+
+		// for readByLines
 		Mesh* mesh;
 		int verticesLeft;
 		int trianglesLeft;
-		const char* filename;
 
-	public:
-		PLYReader(const char* _filename) {
-			content = string(textFileRead(_filename));
-			filename = _filename;
+		static bool isSpace(char c) {
+			return c == ' ' || c == '\t' || c == '\r';
 		}
 
-		// returns a Mesh containing data from ply file
-		// caller is responsible for deleting Mesh when done
-		Mesh* read() {
-			verticesLeft = -1;
-			trianglesLeft = -1;
-			stringstream stream(content, stringstream::in);
-			string line;
-			unsigned lineNum = 0;
-			while(getline(stream, line)) {
-				parseLine(line, lineNum);
-				lineNum++;
+		static bool isDigit(char c) {
+			return c >= '0' && c <= '9';
+		}
+
+		void fail(const char* reason) {
+			stringstream message;
+			if(body != NULL) {
+				message << filename << " byte " << pos - body << " after the header: " << reason;
+			} else {
+				message << filename << " line " << lineNum + 1 << ": " << reason;
 			}
-			if(verticesLeft != 0) {
-				throw ReaderException("Not enough vertices");
+			throw ReaderException(message.str());
+		}
+
+		void skipSpaces() {
+			while(pos < end && isSpace(*pos)) {
+				pos++;
 			}
-			if(trianglesLeft != 0) {
-				throw ReaderException("Not enough triangles");
+		}
+
+		// move to the start of the next line, skipping the rest of this one
+		void nextLine() {
+			while(pos < end && *pos != '\n') {
+				pos++;
 			}
-			return mesh;
+			if(pos < end) {
+				pos++;
+			}
+			lineNum++;
+		}
+
+		// skip past word if it's the next thing on the line
+		bool match(const char* word) {
+			skipSpaces();
+			const char* p = pos;
+			for(; *word != '\0'; word++, p++) {
+				if(p == end || *p != *word) {
+					return false;
+				}
+			}
+			if(p < end && !isSpace(*p) && *p != '\n') {
+				return false; // only the start of a longer word
+			}
+			pos = p;
+			return true;
+		}
+
+		unsigned parseUnsigned() {
+			skipSpaces();
+			if(pos == end || !isDigit(*pos)) {
+				fail("Expected a whole number");
+			}
+			unsigned value = 0;
+			for(; pos < end && isDigit(*pos); pos++) {
+				value = value * 10 + (*pos - '0');
+			}
+			return value;
+		}
+
+		// 10^n, exactly for the powers a double holds exactly
+		static double powerOfTen(int n) {
+			static const double exact[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+				1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+				1e21, 1e22
+			};
+			return n <= 22 ? exact[n] : pow(10.0, n);
+		}
+
+		// decimal digits, then the exponent, scaled in one step at the end
+		float parseFloat() {
+			skipSpaces();
+			bool negative = false;
+			if(pos < end && (*pos == '-' || *pos == '+')) {
+				negative = *pos == '-';
+				pos++;
+			}
+			unsigned long long mantissa = 0;
+			int exponent = 0;
+			unsigned digits = 0;
+			for(; pos < end && isDigit(*pos); pos++, digits++) {
+				if(mantissa < 100000000000000000ULL) {
+					mantissa = mantissa * 10 + (*pos - '0');
+				} else {
+					exponent++; // past what matters for a float
+				}
+			}
+			if(pos < end && *pos == '.') {
+				for(pos++; pos < end && isDigit(*pos); pos++, digits++) {
+					if(mantissa < 100000000000000000ULL) {
+						mantissa = mantissa * 10 + (*pos - '0');
+						exponent--;
+					}
+				}
+			}
+			if(digits == 0) {
+				fail("Expected a number");
+			}
+			if(pos < end && (*pos == 'e' || *pos == 'E')) {
+				pos++;
+				bool negativeExponent = false;
+				if(pos < end && (*pos == '-' || *pos == '+')) {
+					negativeExponent = *pos == '-';
+					pos++;
+				}
+				int written = (int)parseUnsigned();
+				exponent += negativeExponent ? -written : written;
+			}
+			double value = (double)mantissa;
+			value = exponent < 0 ? value / powerOfTen(-exponent) : value * powerOfTen(exponent);
+			return (float)(negative ? -value : value);
+		}
+
+		// the rest of the line's word, only used for the header
+		string readWord() {
+			skipSpaces();
+			const char* start = pos;
+			while(pos < end && !isSpace(*pos) && *pos != '\n') {
+				pos++;
+			}
+			if(pos == start) {
+				fail("Header line ends early");
+			}
+			return string(start, pos);
+		}
+
+		Type readType() {
+			static const char* names[][2] = {
+				{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" },
+				{ "ushort", "uint16" }, { "int", "int32" }, { "uint", "uint32" },
+				{ "float", "float32" }, { "double", "float64" }
+			};
+			string word = readWord();
+			for(int type = INT8; type <= FLOAT64; type++) {
+				if(word == names[type][0] || word == names[type][1]) {
+					return (Type)type;
+				}
+			}
+			fail("Unknown property type");
+			return FLOAT32;
+		}
+
+		static unsigned typeSize(Type type) {
+			static const unsigned sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+			return sizes[type];
+		}
+
+		// the header up to and including end_header
+		void readHeader() {
+			elements.clear();
+			if(!match("ply")) {
+				fail("Doesn't start with ply");
+			}
+			nextLine();
+			bool haveFormat = false;
+			while(!match("end_header")) {
+				if(pos == end) {
+					fail("No end_header");
+				}
+				if(match("format")) {
+					if(match("ascii")) {
+						format = ASCII;
+					} else if(match("binary_little_endian")) {
+						format = BINARY_LITTLE_ENDIAN;
+					} else if(match("binary_big_endian")) {
+						format = BINARY_BIG_ENDIAN;
+					} else {
+						fail("Unknown format");
+					}
+					haveFormat = true;
+				} else if(match("element")) {
+					Element element;
+					element.name = readWord();
+					element.count = parseUnsigned();
+					elements.push_back(element);
+				} else if(match("property")) {
+					if(elements.empty()) {
+						fail("Property before any element");
+					}
+					Property property;
+					property.list = match("list");
+					property.countType = property.list ? readType() : UINT8;
+					property.type = readType();
+					property.name = readWord();
+					elements.back().properties.push_back(property);
+				} else if(!match("comment") && !match("obj_info")) {
+					fail("Unknown header line");
+				}
+				nextLine();
+			}
+			nextLine();
+			if(!haveFormat) {
+				fail("Header has no format");
+			}
+		}
+
+		const Element* findElement(const char* name) const {
+			for(vector<Element>::const_iterator i = elements.begin(); i != elements.end(); ++i) {
+				if(i->name == name) {
+					return &*i;
+				}
+			}
+			return NULL;
+		}
+
+		// index of the property called name or alias, -1 if there isn't one
+		static int findProperty(const Element& element, const char* name, const char* alias) {
+			for(unsigned i = 0; i < element.properties.size(); i++) {
+				const string& found = element.properties[i].name;
+				if(found == name || (alias != NULL && found == alias)) {
+					return i;
+				}
+			}
+			return -1;
+		}
+
+		static bool hostIsLittleEndian() {
+			unsigned one = 1;
+			return *(const char*)&one == 1;
+		}
+
+		// true if binary values can be used as they are, without swapping
+		bool nativeOrder() const {
+			return format == (hostIsLittleEndian() ? BINARY_LITTLE_ENDIAN : BINARY_BIG_ENDIAN);
+		}
+
+		template<typename T>
+		static T load(const char* bytes) {
+			T value;
+			memcpy(&value, bytes, sizeof(T));
+			return value;
+		}
+
+		// make sure there are size more bytes to read
+		void need(size_t size) {
+			if((size_t)(end - pos) < size) {
+				fail("File ends early");
+			}
+		}
+
+		// next value of type, from a binary body
+		double readBinary(Type type) {
+			unsigned size = typeSize(type);
+			need(size);
+			char bytes[8];
+			memcpy(bytes, pos, size);
+			pos += size;
+			if(!nativeOrder()) {
+				std::reverse(bytes, bytes + size);
+			}
+			switch(type) {
+				case INT8: return load<signed char>(bytes);
+				case UINT8: return load<unsigned char>(bytes);
+				case INT16: return load<short>(bytes);
+				case UINT16: return load<unsigned short>(bytes);
+				case INT32: return load<int>(bytes);
+				case UINT32: return load<unsigned>(bytes);
+				case FLOAT32: return load<float>(bytes);
+				default: return load<double>(bytes);
+			}
+		}
+
+		// next value of type, in whichever format the body is
+		double readValue(Type type) {
+			return format == ASCII ? parseFloat() : readBinary(type);
+		}
+
+		unsigned readCount(Type type) {
+			return format == ASCII ? parseUnsigned() : (unsigned)readBinary(type);
+		}
+
+		// read or skip one property of the current element
+		// returns its value, or 0 for a list
+		double readProperty(const Property& property) {
+			if(!property.list) {
+				return readValue(property.type);
+			}
+			unsigned count = readCount(property.countType);
+			if(format != ASCII) {
+				need((size_t)count * typeSize(property.type));
+				pos += (size_t)count * typeSize(property.type);
+				return 0;
+			}
+			for(unsigned i = 0; i < count; i++) {
+				parseFloat();
+			}
+			return 0;
+		}
+
+		void skipElement(const Element& element) {
+			for(unsigned i = 0; i < element.count; i++) {
+				for(unsigned p = 0; p < element.properties.size(); p++) {
+					readProperty(element.properties[p]);
+				}
+				if(format == ASCII) {
+					nextLine();
+				}
+			}
+		}
+
+		// bytes in one binary record of element, 0 if it has a list and
+		// records vary in size
+		static size_t recordSize(const Element& element) {
+			size_t size = 0;
+			for(unsigned p = 0; p < element.properties.size(); p++) {
+				if(element.properties[p].list) {
+					return 0;
+				}
+				size += typeSize(element.properties[p].type);
+			}
+			return size;
+		}
+
+		// byte offset of property index in a fixed size binary record
+		static size_t offsetOf(const Element& element, int index) {
+			size_t offset = 0;
+			for(int p = 0; p < index; p++) {
+				offset += typeSize(element.properties[p].type);
+			}
+			return offset;
+		}
+
+		// which properties of the vertex element are x, y and z
+		void findAxes(const Element& element, int axes[3]) {
+			const char* names[] = { "x", "y", "z" };
+			for(int axis = 0; axis < 3; axis++) {
+				axes[axis] = findProperty(element, names[axis], NULL);
+				if(axes[axis] < 0 || element.properties[axes[axis]].list) {
+					fail("Vertices need x, y and z");
+				}
+			}
+		}
+
+		// which property of the face element is the list of indices
+		int findIndices(const Element& element) {
+			int indices = findProperty(element, "vertex_indices", "vertex_index");
+			if(indices < 0 || !element.properties[indices].list) {
+				fail("Faces need a vertex_indices list");
+			}
+			return indices;
+		}
+
+		// one vertex record, not including the end of its line
+		vec4 readVertex(const Element& element, const int axes[3]) {
+			vec4 vertex(0, 0, 0, 1);
+			for(unsigned p = 0; p < element.properties.size(); p++) {
+				double value = readProperty(element.properties[p]);
+				for(int axis = 0; axis < 3; axis++) {
+					if((int)p == axes[axis]) {
+						vertex[axis] = value;
+					}
+				}
+			}
+			return vertex;
+		}
+
+		void checkCorners(const unsigned corners[3], unsigned vertices) {
+			if(corners[0] >= vertices || corners[1] >= vertices || corners[2] >= vertices) {
+				fail("Vertex index out of range");
+			}
+		}
+
+		// one face record into corners, not including the end of its line
+		void readFace(const Element& element, int indices, unsigned vertices, unsigned corners[3]) {
+			for(unsigned p = 0; p < element.properties.size(); p++) {
+				if((int)p != indices) {
+					readProperty(element.properties[p]);
+					continue;
+				}
+				const Property& list = element.properties[p];
+				if(readCount(list.countType) != 3) {
+					fail("Only triangles can be read");
+				}
+				for(int c = 0; c < 3; c++) {
+					corners[c] = format == ASCII ? parseUnsigned() : (unsigned)readBinary(list.type);
+				}
+			}
+			checkCorners(corners, vertices);
+		}
+
+		void readVertices(const Element& element, Mesh* mesh) {
+			int axes[3];
+			findAxes(element, axes);
+
+			// float x, y and z in our byte order can be copied straight out
+			// of fixed size records, with nothing to parse
+			size_t stride = format == ASCII ? 0 : recordSize(element);
+			bool direct = stride != 0 && nativeOrder();
+			for(int axis = 0; axis < 3; axis++) {
+				direct = direct && element.properties[axes[axis]].type == FLOAT32;
+			}
+			if(direct) {
+				need((size_t)element.count * stride);
+				size_t offsets[3];
+				for(int axis = 0; axis < 3; axis++) {
+					offsets[axis] = offsetOf(element, axes[axis]);
+				}
+				for(unsigned i = 0; i < element.count; i++, pos += stride) {
+					vec4 vertex(load<float>(pos + offsets[0]), load<float>(pos + offsets[1]),
+						load<float>(pos + offsets[2]), 1);
+					mesh->addVertex(vertex);
+				}
+				return;
+			}
+
+			for(unsigned i = 0; i < element.count; i++) {
+				if(pos == end) {
+					fail("Not enough vertices");
+				}
+				mesh->addVertex(readVertex(element, axes));
+				if(format == ASCII) {
+					nextLine();
+				}
+			}
+		}
+
+		void readFaces(const Element& element, Mesh* mesh, unsigned vertices) {
+			int indices = findIndices(element);
+			const Property& list = element.properties[indices];
+
+			// faces that are only a byte count and 32 bit indices in our byte
+			// order are read a whole triangle at a time
+			bool direct = format != ASCII && nativeOrder() && element.properties.size() == 1
+				&& typeSize(list.countType) == 1
+				&& (list.type == INT32 || list.type == UINT32);
+			if(direct) {
+				const size_t record = 1 + 3 * sizeof(unsigned);
+				need((size_t)element.count * record);
+				for(unsigned i = 0; i < element.count; i++, pos += record) {
+					if(*pos != 3) {
+						fail("Only triangles can be read");
+					}
+					unsigned corners[3];
+					memcpy(corners, pos + 1, sizeof(corners));
+					checkCorners(corners, vertices);
+					mesh->addTriangle(corners[0], corners[1], corners[2]);
+				}
+				return;
+			}
+
+			for(unsigned i = 0; i < element.count; i++) {
+				if(pos == end) {
+					fail("Not enough triangles");
+				}
+				unsigned corners[3];
+				readFace(element, indices, vertices, corners);
+				mesh->addTriangle(corners[0], corners[1], corners[2]);
+				if(format == ASCII) {
+					nextLine();
+				}
+			}
+		}
+
+		// ascii bodies of at least two pieces about this big are split up
+		// and parsed on several threads, when there are several cores
+		enum { CHUNK_BYTES = 1 << 22 };
+
+		// some whole lines of an ascii body, and what was parsed from them
+		struct Chunk {
+			const char* begin;
+			const char* end;
+			unsigned lines;     // newlines in it
+			unsigned firstLine; // of the body
+			vector<vec4> vertices;
+			vector<unsigned> corners; // three per triangle
+			std::exception_ptr error;
+		};
+
+		static unsigned countLines(const char* begin, const char* end) {
+			unsigned lines = 0;
+			while(begin < end && (begin = (const char*)memchr(begin, '\n', end - begin)) != NULL) {
+				lines++;
+				begin++;
+			}
+			return lines;
+		}
+
+		// parse chunk into its own buffers, moving this reader's position
+		// so each thread needs its own copy of the reader
+		// elements are given by index, as each copy has its own
+		void parseChunk(Chunk& chunk, unsigned headerLines, unsigned vertexElement,
+				unsigned faceElement, const int axes[3], int indices) {
+			pos = chunk.begin;
+			end = chunk.end;
+			lineNum = headerLines + chunk.firstLine;
+
+			// the element the chunk starts in, and the body line it starts on
+			unsigned element = 0, elementLine = 0;
+			while(element < elements.size() && chunk.firstLine >= elementLine + elements[element].count) {
+				elementLine += elements[element++].count;
+			}
+			for(unsigned line = chunk.firstLine; pos < end && element < elements.size(); line++) {
+				const Element& current = elements[element];
+				if(element == vertexElement) {
+					chunk.vertices.push_back(readVertex(current, axes));
+				} else if(element == faceElement) {
+					unsigned corners[3];
+					readFace(current, indices, elements[vertexElement].count, corners);
+					chunk.corners.insert(chunk.corners.end(), corners, corners + 3);
+				}
+				nextLine();
+				while(element < elements.size() && line + 1 >= elementLine + elements[element].count) {
+					elementLine += elements[element++].count;
+				}
+			}
+		}
+
+		// read an ascii body in chunks, on as many threads as there are
+		// chunks to go round, and then put them together in order
+		// returns false, having read nothing, if the body is too short,
+		// so the one pass reader can say where it ran out
+		bool readInChunks(const Element* vertexElement, const Element* faceElement, Mesh* mesh) {
+			int axes[3];
+			findAxes(*vertexElement, axes);
+			int indices = findIndices(*faceElement);
+
+			// split into pieces that each end after a newline
+			size_t bytes = end - pos;
+			vector<Chunk> chunks(bytes / CHUNK_BYTES);
+			const char* begin = pos;
+			for(size_t c = 0; c < chunks.size(); c++) {
+				const char* split = c + 1 == chunks.size() ? end : pos + (c + 1) * (bytes / chunks.size());
+				split = std::max(split, begin);
+				while(split < end && split[-1] != '\n') {
+					split++;
+				}
+				chunks[c].begin = begin;
+				chunks[c].end = begin = split;
+			}
+
+			unsigned workers = std::min((size_t)workerCount(), chunks.size());
+			std::atomic<unsigned> next(0);
+			parallelFor(workers, [&](unsigned) {
+				for(unsigned c; (c = next++) < chunks.size();) {
+					chunks[c].lines = countLines(chunks[c].begin, chunks[c].end);
+				}
+			});
+			unsigned lines = 0;
+			for(size_t c = 0; c < chunks.size(); c++) {
+				chunks[c].firstLine = lines;
+				lines += chunks[c].lines;
+			}
+			if(end[-1] != '\n') {
+				lines++; // last line has no newline
+			}
+			unsigned needed = 0;
+			for(const Element* e = &elements[0]; e <= faceElement; e++) {
+				needed += e->count;
+			}
+			if(lines < needed) {
+				return false;
+			}
+
+			unsigned headerLines = lineNum;
+			unsigned vertexIndex = vertexElement - &elements[0], faceIndex = faceElement - &elements[0];
+			next = 0;
+			parallelFor(workers, [&](unsigned) {
+				PLYReader parser(*this);
+				for(unsigned c; (c = next++) < chunks.size();) {
+					try {
+						parser.parseChunk(chunks[c], headerLines, vertexIndex, faceIndex, axes, indices);
+					} catch(...) {
+						chunks[c].error = std::current_exception();
+					}
+				}
+			});
+
+			// the first error in the file is the one to report
+			for(size_t c = 0; c < chunks.size(); c++) {
+				if(chunks[c].error) {
+					std::rethrow_exception(chunks[c].error);
+				}
+			}
+			for(size_t c = 0; c < chunks.size(); c++) {
+				for(size_t i = 0; i < chunks[c].vertices.size(); i++) {
+					mesh->addVertex(chunks[c].vertices[i]);
+				}
+			}
+			mesh->startTriangles(faceElement->count);
+			for(size_t c = 0; c < chunks.size(); c++) {
+				const vector<unsigned>& corners = chunks[c].corners;
+				for(size_t i = 0; i < corners.size(); i += 3) {
+					mesh->addTriangle(corners[i], corners[i + 1], corners[i + 2]);
+				}
+			}
+			pos = end;
+			return true;
 		}
 
 		void parseLine(string line, unsigned lineNum) {
@@ -65,7 +671,7 @@ class PLYReader {
 			stringstream ss(stringstream::in);
 			ss.str(line);
 			string garbage;
-			
+
 			if(startsWith(line, "element vertex")) {
 				ss >> garbage >> garbage >> verticesLeft;
 				mesh = new Mesh(filename, verticesLeft);
@@ -99,11 +705,101 @@ class PLYReader {
 
 		}
 
-		static bool startsWith(string str, string prefix) {
-			return str.substr(0, prefix.size()) == prefix;
+	public:
+		PLYReader(const char* _filename) {
+			filename = _filename;
+			format = ASCII;
+			body = NULL;
+		}
+
+		// returns a Mesh containing data from ply file
+		// caller is responsible for deleting Mesh when done
+		Mesh* read() {
+			MappedFile file;
+			if(!file.open(filename)) {
+				throw ReaderException(string("Couldn't open ") + filename);
+			}
+			pos = file.getData();
+			end = pos + file.getSize();
+			lineNum = 0;
+			body = NULL;
+
+			readHeader();
+			if(format != ASCII) {
+				body = pos;
+			}
+			const Element* vertexElement = findElement("vertex");
+			const Element* faceElement = findElement("face");
+			if(vertexElement == NULL || faceElement == NULL) {
+				fail("Header is missing the vertex or face element");
+			}
+			if(faceElement < vertexElement) {
+				fail("Faces come before vertices");
+			}
+			Mesh* mesh = new Mesh(filename, vertexElement->count);
+			try {
+				if(format == ASCII && end - pos >= 2 * CHUNK_BYTES && workerCount() > 1
+						&& readInChunks(vertexElement, faceElement, mesh)) {
+					return mesh;
+				}
+				for(vector<Element>::const_iterator i = elements.begin(); i != elements.end(); ++i) {
+					if(&*i == vertexElement) {
+						readVertices(*i, mesh);
+					} else if(&*i == faceElement) {
+						mesh->startTriangles(i->count);
+						readFaces(*i, mesh, vertexElement->count);
+					} else {
+						skipElement(*i);
+					}
+				}
+			} catch(...) {
+				delete mesh;
+				throw;
+			}
+			return mesh;
+		}
+
+		Format getFormat() const {
+			return format;
+		}
+
+		// the elements and properties from the header of the last read
+		const vector<Element>& getElements() const {
+			return elements;
+		}
+
+		// the original reader, a stringstream per line, kept to compare
+		// read against
+		// caller is responsible for deleting Mesh when done
+		Mesh* readByLines() {
+			char* text = textFileRead(filename);
+			if(text == NULL) {
+				throw ReaderException(string("Couldn't open ") + filename);
+			}
+			string content(text);
+			free(text);
+			verticesLeft = -1;
+			trianglesLeft = -1;
+			stringstream stream(content, stringstream::in);
+			string line;
+			unsigned lineNum = 0;
+			while(getline(stream, line)) {
+				parseLine(line, lineNum);
+				lineNum++;
+			}
+			if(verticesLeft != 0) {
+				throw ReaderException("Not enough vertices");
+			}
+			if(trianglesLeft != 0) {
+				throw ReaderException("Not enough triangles");
+			}
+			return mesh;
+		}
+
+		static bool startsWith(const string& str, const string& prefix) {
+			return str.compare(0, prefix.size(), prefix) == 0;
 		}
 
 };
 
 #endif
-
@@ -0,0 +1,125 @@
+
+#ifndef __PARALLEL_H_
+#define __PARALLEL_H_
+
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using std::thread;
+using std::vector;
+using std::deque;
+using std::mutex;
+
+// number of worker threads to split work between
+inline unsigned workerCount() {
+	unsigned count = thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+// call body(worker) once for each worker in [0, workers) on its own thread
+// blocks until every worker is done
+template<typename Body>
+void parallelFor(unsigned workers, Body body) {
+	if(workers <= 1) {
+		body(0);
+		return;
+	}
+	vector<thread> threads;
+	threads.reserve(workers - 1);
+	for(unsigned i = 1; i < workers; i++) {
+		threads.push_back(thread(body, i));
+	}
+	body(0); // calling thread does a share too
+	for(unsigned i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+// tasks shared between workers that can each add more while running
+// a worker takes the newest task from its own queue, and when that's empty
+// steals the oldest from another's, so big early tasks get split up
+template<typename Task>
+class WorkQueue {
+	private:
+		struct Queue {
+			mutex lock;
+			deque<Task> tasks;
+		};
+		vector<Queue*> queues;
+		std::atomic<unsigned long long> pending; // pushed but not finished
+
+		bool take(unsigned worker, Task& task) {
+			Queue* own = queues[worker];
+			{
+				std::lock_guard<mutex> guard(own->lock);
+				if(!own->tasks.empty()) {
+					task = own->tasks.back();
+					own->tasks.pop_back();
+					return true;
+				}
+			}
+			for(unsigned i = 1; i < queues.size(); i++) {
+				Queue* other = queues[(worker + i) % queues.size()];
+				std::lock_guard<mutex> guard(other->lock);
+				if(!other->tasks.empty()) {
+					task = other->tasks.front();
+					other->tasks.pop_front();
+					return true;
+				}
+			}
+			return false;
+		}
+
+	public:
+		WorkQueue(unsigned workers):pending(0) {
+			for(unsigned i = 0; i < (workers == 0 ? 1 : workers); i++) {
+				queues.push_back(new Queue());
+			}
+		}
+
+		~WorkQueue() {
+			for(unsigned i = 0; i < queues.size(); i++) {
+				delete queues[i];
+			}
+		}
+
+		unsigned getWorkers() {
+			return queues.size();
+		}
+
+		// add a task to worker's queue, safe to call from inside run
+		void push(unsigned worker, const Task& task) {
+			pending++;
+			std::lock_guard<mutex> guard(queues[worker]->lock);
+			queues[worker]->tasks.push_back(task);
+		}
+
+		// call body(worker, task) for every task until none are left,
+		// including any body pushes while it runs
+		template<typename Body>
+		void run(Body body) {
+			parallelFor(queues.size(), [&](unsigned worker) {
+				Task task;
+				while(pending > 0) {
+					if(take(worker, task)) {
+						body(worker, task);
+						pending--;
+					} else {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+};
+
+// seconds since some arbitrary fixed point, for timing things
+inline double secondsNow() {
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
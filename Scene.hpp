@@ -3,44 +3,151 @@
 #define __SCENE_H_
 
 #include "LSystemRenderer.hpp"
+#include "VertexFormat.hpp"
 
 class Scene {
 	private:
 		int screenWidth;
 		int screenHeight;
 		mat4 projection;
-		GLuint program;
+		ShaderProgram* program;
+		// looked up once when the scene is made
+		GLint projectionLoc;
+		GLint modelLoc;
+		GLint colorLoc;
+		GLint positionLoc;
 		vector<Mesh*> meshes;
+		GLuint indexBuffer; // every mesh's indices, 0 until first buffered
+		VertexFormat::Position positionFormat; // of every mesh in the buffer
+		GLsizeiptr bufferedBytes[2]; // vertices and indices last buffered
 		Mesh* cow;
 		Mesh* car;
+
+		// frame time statistics, printed every statsInterval frames
+		bool showStats;
+		unsigned statsFrames;
+		double statsSeconds;
+		unsigned long long statsCalls; // GL calls made by the frames
+		unsigned long long statsCulled; // segments and meshes culled by them
+		unsigned long long statsCulledTrees;
+		unsigned long long statsCulledMeshes;
+		unsigned long long culledMeshes; // this frame
+		static const unsigned statsInterval = 60;
+
+		void recordFrameTime(double seconds, unsigned long long calls) {
+			statsFrames++;
+			statsSeconds += seconds;
+			statsCalls += calls;
+			statsCulled += lsysRenderer.getCulledSegments();
+			statsCulledTrees += lsysRenderer.getCulledTrees();
+			statsCulledMeshes += culledMeshes;
+			if(statsFrames == statsInterval) {
+				cout << lsysRenderer.getDrawModeName() << ": "
+					<< statsSeconds / statsFrames * 1000 << " ms/frame, "
+					<< statsCalls / statsFrames << " GL calls/frame, "
+					<< statsCulled / statsFrames << " segments, "
+					<< statsCulledTrees / statsFrames << " trees and "
+					<< statsCulledMeshes / statsFrames << " meshes culled/frame" << endl;
+				statsFrames = 0;
+				statsSeconds = 0;
+				statsCalls = 0;
+				statsCulled = 0;
+				statsCulledTrees = 0;
+				statsCulledMeshes = 0;
+			}
+		}
+
+		// draw mesh with model matrix unless it's out of view
+		void drawMesh(Mesh* mesh, const mat4& model, const ViewFrustum& frustum) {
+			BoundingBox* box = mesh->getBoundingBox();
+			if(frustum.test(Bounds::transformed(model, box->getMin(), box->getMax())) == ViewFrustum::OUTSIDE) {
+				culledMeshes++;
+				return;
+			}
+			program->setUniform(modelLoc, model);
+			program->setPositionDecode(mesh->getPositionScale(), mesh->getPositionOffset());
+			program->drawElements(GL_TRIANGLES, mesh->getNumIndices(), mesh->getIndexType(),
+				mesh->getIndexOffset(), mesh->getDrawOffset());
+		}
 		
 		void resetProjection() {
+			vec3 eye(20, 50, 20);
+			float fovy = 90;
+			// trees far from the camera are drawn in less detail
+			lsysRenderer.setCamera(eye, fovy, screenHeight);
 			if(screenHeight == 0) {
 				projection = mat4(); // don't want to divide by zero...
 				return;
 			}
 			projection = mat4()
-				* Perspective(90, (float)screenWidth/screenHeight, 0.0000001, 100000)
-				* LookAt(vec3(20, 50, 20), vec3(-20, 20, -20), vec3(0, 1, 0));
+				* Perspective(fovy, (float)screenWidth/screenHeight, 0.0000001, 100000)
+				* LookAt(eye, vec3(-20, 20, -20), vec3(0, 1, 0));
+		}
+
+		// each mesh's indices start on a 4 byte boundary, so 16 and 32 bit
+		// ones can share a buffer
+		static GLsizeiptr alignIndices(GLsizeiptr bytes) {
+			return (bytes + 3) & ~(GLsizeiptr)3;
+		}
+
+		// add up the space meshes take in the vertex and index buffers
+		void countBytes(vector<Mesh*>* meshes, GLsizeiptr& vertexBytes, GLsizeiptr& indexBytes) {
+			for (vector<Mesh*>::const_iterator i = meshes->begin(); i != meshes->end(); ++i) {
+				vertexBytes += (GLsizeiptr)(*i)->getNumVertices() * VertexFormat::stride(positionFormat);
+				indexBytes += alignIndices((*i)->getNumIndexBytes());
+			}
 		}
 
-		// returns next empty space in buffer
-		GLuint bufferMeshes(GLuint bufferStart, vector<Mesh*>* meshes) {
+		// copy meshes into the buffers from vertexStart and indexStart,
+		// which are moved on to the next empty space
+		// vertices are stored in positionFormat
+		void bufferMeshes(vector<Mesh*>* meshes, GLsizeiptr& vertexStart, GLsizeiptr& indexStart) {
+			GLsizei stride = VertexFormat::stride(positionFormat);
+			vector<char> packed;
 			for (vector<Mesh*>::const_iterator i = meshes->begin(); i != meshes->end(); ++i) {
 				Mesh* mesh = *i;
-				GLsizeiptr bytes = mesh->getNumBytes();
-				mesh->setDrawOffset(bufferStart / sizeof(mesh->getPoints()[0]));
-				glBufferSubData(GL_ARRAY_BUFFER, bufferStart, bytes, mesh->getPoints());
-				bufferStart += bytes;
+				GLsizeiptr bytes = (GLsizeiptr)mesh->getNumVertices() * stride;
+				vec4 scale, offset;
+				VertexFormat::decoding(positionFormat, mesh->getVertices(), mesh->getNumVertices(),
+					scale, offset);
+				mesh->setPositionDecode(scale, offset);
+				mesh->setDrawOffset(vertexStart / stride);
+				if(bytes > 0) {
+					packed.resize(bytes);
+					VertexFormat::pack(positionFormat, mesh->getVertices(), mesh->getNumVertices(),
+						scale, offset, &packed[0]);
+					glBufferSubData(GL_ARRAY_BUFFER, vertexStart, bytes, &packed[0]);
+				}
+				vertexStart += bytes;
+
+				bytes = mesh->getNumIndexBytes();
+				mesh->setIndexOffset(indexStart);
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexStart, bytes, mesh->getIndices());
+				indexStart += alignIndices(bytes);
 			}
-			return bufferStart;
 		}
 
 	public:
 		LSystemRenderer& lsysRenderer;
 		
-		Scene(GLuint program, LSystemRenderer& lr):lsysRenderer(lr) {
+		Scene(ShaderProgram* program, LSystemRenderer& lr):lsysRenderer(lr) {
 			this->program = program;
+			screenWidth = screenHeight = 0;
+			indexBuffer = 0;
+			positionFormat = VertexFormat::FLOAT3;
+			bufferedBytes[0] = bufferedBytes[1] = 0;
+			projectionLoc = program->getUniform("projection_matrix");
+			modelLoc = program->getUniform("model_matrix");
+			colorLoc = program->getUniform("inColor");
+			positionLoc = program->getAttribute("vPosition");
+			showStats = false;
+			statsFrames = 0;
+			statsSeconds = 0;
+			statsCalls = 0;
+			statsCulled = 0;
+			statsCulledTrees = 0;
+			statsCulledMeshes = 0;
+			culledMeshes = 0;
 			
 			PLYReader cowReader("meshes/cow.ply");
 			cow = cowReader.read();
@@ -55,49 +162,89 @@ class Scene {
 		}
 
 		void bufferPoints() {
-			GLsizeiptr totalBytes = lsysRenderer.getTotalBytes();
-			totalBytes += cow->getNumBytes();
-			totalBytes += car->getNumBytes();
-			glBufferData(GL_ARRAY_BUFFER, totalBytes, NULL, GL_STATIC_DRAW);
+			GLsizeiptr vertexBytes = 0, indexBytes = 0;
+			countBytes(&meshes, vertexBytes, indexBytes);
+			countBytes(lsysRenderer.getMeshes(), vertexBytes, indexBytes);
+			glBufferData(GL_ARRAY_BUFFER, vertexBytes, NULL, GL_STATIC_DRAW);
+			if(indexBuffer == 0) {
+				glGenBuffers(1, &indexBuffer);
+			}
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
 
-			GLuint bufferStart = bufferMeshes(0, &meshes);
-			bufferStart = bufferMeshes(bufferStart, lsysRenderer.getMeshes());
+			GLsizeiptr vertexStart = 0, indexStart = 0;
+			bufferMeshes(&meshes, vertexStart, indexStart);
+			bufferMeshes(lsysRenderer.getMeshes(), vertexStart, indexStart);
+			bufferedBytes[0] = vertexBytes;
+			bufferedBytes[1] = indexBytes;
 			
-			GLuint posLoc = glGetAttribLocation(program, "vPosition");
-			glEnableVertexAttribArray(posLoc);
-			glVertexAttribPointer(posLoc, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+			glEnableVertexAttribArray(positionLoc);
+			VertexFormat::setAttribute(positionFormat, positionLoc, 0);
+		}
+
+		// store positions in the next smaller format, or back to the
+		// biggest after the smallest, and say what the buffers take now
+		void cycleVertexFormat() {
+			GLsizeiptr before = bufferedBytes[0];
+			positionFormat = (VertexFormat::Position)((positionFormat + 1) % VertexFormat::NUM_POSITION_FORMATS);
+			bufferPoints();
+			cout << VertexFormat::name(positionFormat) << " positions: " << bufferedBytes[0] / 1024
+				<< " KB of vertices, was " << before / 1024 << " KB, and "
+				<< bufferedBytes[1] / 1024 << " KB of indices" << endl;
+			glutPostRedisplay();
 		}
 
 		void display() {
+			double frameStart = secondsNow();
+			program->resetCallCount();
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			glEnable(GL_DEPTH_TEST);
-			GLuint projLoc = glGetUniformLocationARB(program, "projection_matrix");
-			glUniformMatrix4fv(projLoc, 1, GL_TRUE, projection);
+			program->countCalls(3);
+			program->setUniform(projectionLoc, projection);
 			
+			ViewFrustum frustum(projection);
+			culledMeshes = 0;
 			if(lsysRenderer.forestMode()) {
-				GLuint colorLoc = glGetUniformLocationARB(program, "inColor");
-				glUniform4fv(colorLoc, 1, vec4(1,1,1,1));
-
-				GLuint modelLoc = glGetUniformLocationARB(program, "model_matrix");
-				glUniformMatrix4fv(modelLoc, 1, GL_TRUE, Scale(3));
-				glDrawArrays(GL_TRIANGLES, cow->getDrawOffset(), cow->getNumPoints());
-
-				glUniformMatrix4fv(modelLoc, 1, GL_TRUE, Translate(-20, 0, -10) * RotateY(-60));
-				glDrawArrays(GL_TRIANGLES, car->getDrawOffset(), car->getNumPoints());
+				program->setUniform(colorLoc, vec4(1,1,1,1));
+				drawMesh(cow, Scale(3), frustum);
+				drawMesh(car, Translate(-20, 0, -10) * RotateY(-60), frustum);
 			}
 
-			lsysRenderer.display();
-
+			lsysRenderer.display(projection);
+			if(lsysRenderer.takeMeshesChanged()) {
+				// trees were baked this frame, draw them baked from the next
+				bufferPoints();
+				glutPostRedisplay();
+			}
 
 			glDisable(GL_DEPTH_TEST); 
+			program->countCalls(1);
+
+			if(showStats) {
+				glFinish(); // wait for the GPU so the time is honest
+				recordFrameTime(secondsNow() - frameStart, program->getCallCount());
+				glutPostRedisplay(); // keep drawing frames to time
+			}
 
 			// output to hardware, double buffered
 			glFlush();
 			glutSwapBuffers();
 		}
 
+		// start or stop printing frame times
+		void toggleStats() {
+			showStats = !showStats;
+			statsFrames = 0;
+			statsSeconds = 0;
+			statsCalls = 0;
+			statsCulled = 0;
+			statsCulledTrees = 0;
+			statsCulledMeshes = 0;
+			glutPostRedisplay();
+		}
+
 		void reshape(int screenWidth, int screenHeight) {
 			this->screenWidth = screenWidth;
 			this->screenHeight = screenHeight;
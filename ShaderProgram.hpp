@@ -0,0 +1,166 @@
+#ifndef __SHADERPROGRAM_H_
+#define __SHADERPROGRAM_H_
+
+#include <string>
+#include <map>
+
+#include "Angel.h"
+
+using std::string;
+using std::map;
+
+// a linked shader program with the location of every active uniform and
+// attribute looked up once, so drawing never asks the driver by name
+// GL calls made through it are counted, to see what a frame costs
+class ShaderProgram {
+	private:
+		GLuint id;
+		map<string, GLint> uniforms;
+		map<string, GLint> attributes;
+		unsigned long long calls; // since the last resetCallCount
+		// position_scale and position_offset as last set
+		GLint positionScaleLoc;
+		GLint positionOffsetLoc;
+		vec4 positionScale;
+		vec4 positionOffset;
+
+		// arrays are reported as name[0], but looked up as just name
+		static string baseName(const char* name) {
+			string base(name);
+			size_t bracket = base.find('[');
+			return bracket == string::npos ? base : base.substr(0, bracket);
+		}
+
+		void resolveLocations() {
+			GLint count, maxLength;
+			GLint size;
+			GLenum type;
+
+			glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+			glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+			char* name = new char[maxLength + 1];
+			for(GLint i = 0; i < count; i++) {
+				glGetActiveUniform(id, i, maxLength + 1, NULL, &size, &type, name);
+				uniforms[baseName(name)] = glGetUniformLocation(id, name);
+			}
+			delete[] name;
+
+			glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &count);
+			glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+			name = new char[maxLength + 1];
+			for(GLint i = 0; i < count; i++) {
+				glGetActiveAttrib(id, i, maxLength + 1, NULL, &size, &type, name);
+				attributes[baseName(name)] = glGetAttribLocation(id, name);
+			}
+			delete[] name;
+		}
+
+		static GLint find(const map<string, GLint>& locations, const string& name) {
+			map<string, GLint>::const_iterator found = locations.find(name);
+			return found == locations.end() ? -1 : found->second;
+		}
+
+	public:
+		// compile, link and use the two shaders, then look up locations
+		ShaderProgram(const char* vShaderFile, const char* fShaderFile) {
+			id = InitShader(vShaderFile, fShaderFile);
+			calls = 0;
+			resolveLocations();
+			positionScaleLoc = getUniform("position_scale");
+			positionOffsetLoc = getUniform("position_offset");
+			// what GL starts uniforms at
+			positionScale = positionOffset = vec4(0, 0, 0, 0);
+		}
+
+		GLuint getId() {
+			return id;
+		}
+
+		// location of an active uniform, -1 if the shaders don't use it
+		// meant to be called once and kept, not every draw
+		GLint getUniform(const string& name) const {
+			return find(uniforms, name);
+		}
+
+		// location of an active attribute, -1 if the shaders don't use it
+		GLint getAttribute(const string& name) const {
+			return find(attributes, name);
+		}
+
+		void setUniform(GLint location, const mat4& value) {
+			glUniformMatrix4fv(location, 1, GL_TRUE, value);
+			calls++;
+		}
+
+		void setUniform(GLint location, const vec4& value) {
+			glUniform4fv(location, 1, value);
+			calls++;
+		}
+
+		void setUniform(GLint location, GLfloat value) {
+			glUniform1f(location, value);
+			calls++;
+		}
+
+		void setUniform(GLint location, bool value) {
+			glUniform1i(location, value ? GL_TRUE : GL_FALSE);
+			calls++;
+		}
+
+		void drawArrays(GLenum mode, GLint first, GLsizei count) {
+			glDrawArrays(mode, first, count);
+			calls++;
+		}
+
+		void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+			glDrawArraysInstanced(mode, first, count, instances);
+			calls++;
+		}
+
+		// how the next positions drawn are stored, skipped if it's the same
+		// as the last
+		void setPositionDecode(const vec4& scale, const vec4& offset) {
+			for(int i = 0; i < 4; i++) {
+				if(scale[i] != positionScale[i]) {
+					setUniform(positionScaleLoc, scale);
+					positionScale = scale;
+					break;
+				}
+			}
+			for(int i = 0; i < 4; i++) {
+				if(offset[i] != positionOffset[i]) {
+					setUniform(positionOffsetLoc, offset);
+					positionOffset = offset;
+					break;
+				}
+			}
+		}
+
+		// count indices of type from offset bytes into the element buffer,
+		// each added to baseVertex
+		void drawElements(GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset, GLint baseVertex) {
+			glDrawElementsBaseVertex(mode, count, type, BUFFER_OFFSET(offset), baseVertex);
+			calls++;
+		}
+
+		void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, GLsizeiptr offset,
+				GLint baseVertex, GLsizei instances) {
+			glDrawElementsInstancedBaseVertex(mode, count, type, BUFFER_OFFSET(offset), instances, baseVertex);
+			calls++;
+		}
+
+		// for GL calls made directly rather than through the program
+		void countCalls(unsigned count) {
+			calls += count;
+		}
+
+		unsigned long long getCallCount() {
+			return calls;
+		}
+
+		void resetCallCount() {
+			calls = 0;
+		}
+};
+
+#endif
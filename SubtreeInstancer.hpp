@@ -0,0 +1,301 @@
+#ifndef __SUBTREEINSTANCER_H_
+#define __SUBTREEINSTANCER_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+
+#include "Angel.h"
+#include "Turtle.hpp"
+#include "TurtleRope.hpp"
+#include "Parallel.hpp"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::cout;
+using std::endl;
+
+// interprets each (symbol, generations left) subtree of a rope once
+// every occurrence of a subtree draws the same segments relative to where
+// the turtle enters it, so a subtree is kept as a list of local segments
+// and references to smaller subtrees, and only placed when emitting
+class SubtreeInstancer {
+	public:
+		typedef pair<size_t, size_t> Range; // [first, second) of segments
+
+	private:
+		static const unsigned SEGMENT = ~0u;
+
+		// a segment, or a copy of another subtree, relative to the entry
+		struct Item {
+			unsigned node; // subtree to place here, or SEGMENT
+			TurtleState local;
+		};
+
+		struct Subtree {
+			vector<Item> items;
+			TurtleState exit;  // where the turtle leaves, relative to the entry
+			int minDepth;      // lowest the stack goes, relative to the entry
+			int netDepth;      // pushes left open at the end
+			bool built;        // items and exit are filled in
+			unsigned long long segments; // drawn including nested subtrees
+			vector<Range> branches; // brackets opened and closed in items
+		};
+
+		const TurtleRope* rope;
+		vector<Subtree> subtrees; // one per rope node
+		bool usable;
+		// what building cost against what emitting produces
+		unsigned long long interpretedSegments;
+		unsigned long long references;
+		// while building, segments so far and where open brackets started
+		size_t position;
+		vector<size_t> openBranches;
+
+		// brackets can be split across subtrees, and one that pops below
+		// where it started or leaves pushes open has to be read inline
+		bool isClosed(unsigned node) const {
+			const Subtree& subtree = subtrees[node];
+			return subtree.minDepth >= 0 && subtree.netDepth == 0;
+		}
+
+		void measureDepth(unsigned node) {
+			Subtree& subtree = subtrees[node];
+			subtree.minDepth = 0;
+			subtree.netDepth = 0;
+			if(rope->isLeaf(node)) {
+				const string& literal = rope->getLiteral(node);
+				for(string::const_iterator it = literal.begin(); it != literal.end(); ++it) {
+					if(*it == '[') {
+						subtree.netDepth++;
+					} else if(*it == ']') {
+						subtree.netDepth--;
+						subtree.minDepth = std::min(subtree.minDepth, subtree.netDepth);
+					}
+				}
+				return;
+			}
+			const vector<unsigned>& children = rope->getChildren(node);
+			for(unsigned i = 0; i < children.size(); i++) {
+				const Subtree& child = subtrees[children[i]];
+				subtree.minDepth = std::min(subtree.minDepth, subtree.netDepth + child.minDepth);
+				subtree.netDepth += child.netDepth;
+			}
+		}
+
+		// run node's symbols with turtle, adding segments and references
+		// to subtrees that are already built onto out
+		void interpret(unsigned node, Turtle* turtle, Subtree& out) {
+			if(rope->isLeaf(node)) {
+				const string& literal = rope->getLiteral(node);
+				for(string::const_iterator it = literal.begin(); it != literal.end(); ++it) {
+					const mat3* turn;
+					switch(*it) {
+						case 'F':
+							addItem(out, SEGMENT, turtle->getState());
+							interpretedSegments++;
+							position++;
+							turtle->forward();
+							break;
+						case 'f':
+							turtle->forward();
+							break;
+						case '[':
+							turtle->push();
+							openBranches.push_back(position);
+							break;
+						case ']':
+							turtle->pop();
+							if(!openBranches.empty()) {
+								out.branches.push_back(Range(openBranches.back(), position));
+								openBranches.pop_back();
+							}
+							break;
+						default:
+							turn = turtle->getTurnFor(*it);
+							if(turn != NULL) {
+								turtle->turn(*turn);
+							}
+					}
+				}
+				return;
+			}
+			const vector<unsigned>& children = rope->getChildren(node);
+			for(unsigned i = 0; i < children.size(); i++) {
+				unsigned child = children[i];
+				if(subtrees[child].built) {
+					if(subtrees[child].segments > 0) {
+						addItem(out, child, turtle->getState());
+						references++;
+						position += subtrees[child].segments;
+					}
+					turtle->setState(composeStates(turtle->getState(), subtrees[child].exit));
+				} else {
+					interpret(child, turtle, out);
+				}
+			}
+		}
+
+		void addItem(Subtree& subtree, unsigned node, const TurtleState& local) {
+			Item item;
+			item.node = node;
+			item.local = local;
+			subtree.items.push_back(item);
+		}
+
+		void build(unsigned node, Turtle* turtle) {
+			Subtree& subtree = subtrees[node];
+			turtle->start(TurtleState());
+			position = 0;
+			openBranches.clear();
+			interpret(node, turtle, subtree);
+			subtree.exit = turtle->getState();
+			subtree.segments = 0;
+			for(vector<Item>::const_iterator i = subtree.items.begin(); i != subtree.items.end(); ++i) {
+				subtree.segments += i->node == SEGMENT ? 1 : subtrees[i->node].segments;
+			}
+			subtree.built = true;
+		}
+
+		// a subtree to place, for runParallel's workers
+		struct Placement {
+			unsigned node;
+			TurtleState parent;
+			size_t firstSegment;
+		};
+
+		// place node's segments relative to parent
+		// with a queue, subtrees bigger than grain are left to any worker
+		template<typename Drawer>
+		void emit(unsigned node, const TurtleState& parent, Drawer& draw, size_t& segment,
+				WorkQueue<Placement>* queue, unsigned worker, unsigned long long grain) const {
+			const vector<Item>& items = subtrees[node].items;
+			for(vector<Item>::const_iterator i = items.begin(); i != items.end(); ++i) {
+				TurtleState world = composeStates(parent, i->local);
+				if(i->node == SEGMENT) {
+					draw(world, segment);
+					segment++;
+				} else if(queue != NULL && subtrees[i->node].segments > grain) {
+					Placement split = { i->node, world, segment };
+					queue->push(worker, split);
+					segment += subtrees[i->node].segments;
+				} else {
+					emit(i->node, world, draw, segment, queue, worker, grain);
+				}
+			}
+		}
+
+		void collectBranches(unsigned node, size_t base, vector<Range>& out,
+				unsigned long long minSegments) const {
+			const Subtree& subtree = subtrees[node];
+			if(subtree.segments < minSegments) {
+				return; // nothing inside can be big enough either
+			}
+			for(vector<Range>::const_iterator i = subtree.branches.begin(); i != subtree.branches.end(); ++i) {
+				if(i->second - i->first >= minSegments) {
+					out.push_back(Range(base + i->first, base + i->second));
+				}
+			}
+			size_t offset = base;
+			for(vector<Item>::const_iterator i = subtree.items.begin(); i != subtree.items.end(); ++i) {
+				if(i->node == SEGMENT) {
+					offset++;
+				} else {
+					collectBranches(i->node, offset, out, minSegments);
+					offset += subtrees[i->node].segments;
+				}
+			}
+		}
+
+	public:
+		// interpret every subtree of rope once, with turtle's turns and
+		// segment length - turtle's own state is left alone
+		SubtreeInstancer(const TurtleRope* rope, const Turtle* turtle) {
+			this->rope = rope;
+			interpretedSegments = 0;
+			references = 0;
+			Subtree empty;
+			empty.minDepth = 0;
+			empty.netDepth = 0;
+			empty.built = false;
+			empty.segments = 0;
+			subtrees.resize(rope->getNumNodes(), empty);
+
+			Turtle* local = new Turtle(*turtle);
+			unsigned root = rope->getRoot();
+			// children come first, so every closed subtree a node refers
+			// to is built by the time the node is
+			for(unsigned node = 0; node < subtrees.size(); node++) {
+				measureDepth(node);
+				if(node != root && !rope->isLeaf(node) && isClosed(node)) {
+					build(node, local);
+				}
+			}
+			usable = subtrees[root].minDepth >= 0;
+			if(usable) {
+				build(root, local);
+			}
+			delete local;
+		}
+
+		// false if the turtle string pops more than it pushes
+		bool isUsable() const {
+			return usable;
+		}
+
+		unsigned long long getNumSegments() const {
+			return subtrees[rope->getRoot()].segments;
+		}
+
+		// calls draw(state, segment) for every segment in turtle string
+		// order, with the turtle state it starts at in start's frame
+		template<typename Drawer>
+		void run(const TurtleState& start, Drawer& draw) const {
+			size_t segment = 0;
+			emit(rope->getRoot(), start, draw, segment, NULL, 0, 0);
+		}
+
+		// run spread over workers threads, draw is called from all of them
+		template<typename Drawer>
+		void runParallel(const TurtleState& start, Drawer& draw, unsigned workers) const {
+			if(workers <= 1) {
+				run(start, draw);
+				return;
+			}
+			unsigned long long grain = std::max<unsigned long long>(64, getNumSegments() / (workers * 64));
+			WorkQueue<Placement> queue(workers);
+			Placement root = { rope->getRoot(), start, 0 };
+			queue.push(0, root);
+			queue.run([&](unsigned worker, const Placement& placement) {
+				size_t segment = placement.firstSegment;
+				emit(placement.node, placement.parent, draw, segment, &queue, worker, grain);
+			});
+		}
+
+		// add the segments drawn by every bracketed branch with at least
+		// minSegments of them to out, in no particular order
+		void getBranches(vector<Range>& out, unsigned long long minSegments) const {
+			collectBranches(rope->getRoot(), 0, out, std::max(minSegments, 1ULL));
+		}
+
+		// how many segments get drawn for each one actually interpreted
+		double getInstancingFactor() const {
+			return interpretedSegments == 0 ? 1 : (double)getNumSegments() / interpretedSegments;
+		}
+
+		void printStats(string name) const {
+			unsigned built = 0;
+			for(vector<Subtree>::const_iterator i = subtrees.begin(); i != subtrees.end(); ++i) {
+				built += i->built ? 1 : 0;
+			}
+			cout << name << " instancing: " << built << " subtrees, "
+				<< interpretedSegments << " segments interpreted for "
+				<< getNumSegments() << " drawn, " << references << " references, "
+				<< getInstancingFactor() << "x" << endl;
+		}
+};
+
+#endif
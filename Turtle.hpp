@@ -0,0 +1,215 @@
+
+#ifndef __TURTLE_H_
+#define __TURTLE_H_
+
+#include <vector>
+#include <stdexcept>
+
+#include "Angel.h"
+
+using std::vector;
+using std::runtime_error;
+
+// where the turtle is and which way it's facing
+// turtle moves are rigid, so this is all a full 4x4 transform would hold
+struct TurtleState {
+	vec3 position;
+	mat3 orientation; // columns are the turtle's x, y and z axes
+};
+
+// upper left 3x3 of a transform
+inline mat3 rotationPart(const mat4& m) {
+	return mat3(m[0][0], m[1][0], m[2][0],
+	            m[0][1], m[1][1], m[2][1],
+	            m[0][2], m[1][2], m[2][2]);
+}
+
+// state as a full transform, for drawing
+inline mat4 stateTransform(const TurtleState& state) {
+	const mat3& o = state.orientation;
+	const vec3& p = state.position;
+	return mat4(o[0][0], o[1][0], o[2][0], 0,
+	            o[0][1], o[1][1], o[2][1], 0,
+	            o[0][2], o[1][2], o[2][2], 0,
+	            p.x,     p.y,     p.z,     1);
+}
+
+// where local ends up if it's relative to parent
+inline TurtleState composeStates(const TurtleState& parent, const TurtleState& local) {
+	TurtleState world;
+	world.position = parent.position + parent.orientation * local.position;
+	world.orientation = parent.orientation * local.orientation;
+	return world;
+}
+
+// contains basic drawing parameters
+// keeps a stack of states and modifies the top one according to commands
+class Turtle {
+	private:
+		// every turn worked out once rather than calling sin and cos
+		// for every command
+		mat3 turns[7]; // +x, -x, +y, -y, +z, -z, turn around
+		bool prepared;
+		vec3 preparedRotations; // what turns were computed for
+
+		// state stack, allocated up front and never shrunk
+		vector<TurtleState> states;
+		unsigned depth; // index of the current state
+
+		// compute turns if the rotations they depend on changed
+		void prepare() {
+			if(prepared && preparedRotations.x == rotations.x
+					&& preparedRotations.y == rotations.y
+					&& preparedRotations.z == rotations.z) {
+				return;
+			}
+			turns[0] = rotationPart(RotateX(rotations.x));
+			turns[1] = rotationPart(RotateX(-rotations.x));
+			turns[2] = rotationPart(RotateY(rotations.y));
+			turns[3] = rotationPart(RotateY(-rotations.y));
+			turns[4] = rotationPart(RotateZ(rotations.z));
+			turns[5] = rotationPart(RotateZ(-rotations.z));
+			turns[6] = rotationPart(RotateY(180));
+			preparedRotations = rotations;
+			prepared = true;
+		}
+
+	public:
+		unsigned segmentLength;
+		float thickness;
+		const float defaultThickness;
+		vec3 rotations;
+		enum Axis { X, Y, Z };
+
+		Turtle():defaultThickness(0.25) {
+			segmentLength = 0;
+			thickness = defaultThickness;
+			rotations = vec3(0, 0, 0);
+			prepared = false;
+			depth = 0;
+			states.resize(1);
+		}
+
+		Turtle(const Turtle& other):defaultThickness(0.25) {
+			segmentLength = other.segmentLength;
+			thickness = other.thickness;
+			rotations = other.rotations;
+			prepared = other.prepared;
+			if(prepared) {
+				for(int i = 0; i < 7; i++) {
+					turns[i] = other.turns[i];
+				}
+				preparedRotations = other.preparedRotations;
+			}
+			states = other.states;
+			depth = other.depth;
+		}
+
+		// make room for maxDepth nested pushes so none of them allocate
+		void reserveDepth(unsigned maxDepth) {
+			if(states.size() < maxDepth + 1) {
+				states.resize(maxDepth + 1);
+			}
+		}
+
+		// empty the stack and put the turtle at the given transform
+		void start(const mat4& transform) {
+			depth = 0;
+			states[0].position = vec3(transform[0][3], transform[1][3], transform[2][3]);
+			states[0].orientation = rotationPart(transform);
+		}
+
+		// empty the stack and put the turtle in the given state
+		void start(const TurtleState& state) {
+			depth = 0;
+			states[0] = state;
+		}
+
+		const TurtleState& getState() const {
+			return states[depth];
+		}
+
+		// replace the current state without touching the rest of the stack
+		void setState(const TurtleState& state) {
+			states[depth] = state;
+		}
+
+		unsigned getDepth() const {
+			return depth;
+		}
+
+		// the current state as a full transform, for drawing
+		mat4 getTransform() const {
+			return stateTransform(states[depth]);
+		}
+
+		// matrix for one turn about axis
+		const mat3& getTurn(Axis axis, bool positive) {
+			prepare();
+			return turns[axis * 2 + (positive ? 0 : 1)];
+		}
+
+		const mat3& getTurnAround() {
+			prepare();
+			return turns[6];
+		}
+
+		// matrix for a rotation symbol, or NULL if symbol isn't one
+		const mat3* getTurnFor(char symbol) {
+			switch(symbol) {
+				case '+': return &getTurn(X, true);
+				case '-': return &getTurn(X, false);
+				case '&': return &getTurn(Y, true);
+				case '^': return &getTurn(Y, false);
+				case '\\': return &getTurn(Z, true);
+				case '/': return &getTurn(Z, false);
+				case '|': return &getTurnAround();
+			}
+			return NULL;
+		}
+
+		// apply a rotation in the turtle's own frame, like a run of turns
+		void turn(const mat3& r) {
+			mat3& o = states[depth].orientation;
+			for(int row = 0; row < 3; row++) {
+				float x = o[row][0], y = o[row][1], z = o[row][2];
+				o[row][0] = x * r[0][0] + y * r[1][0] + z * r[2][0];
+				o[row][1] = x * r[0][1] + y * r[1][1] + z * r[2][1];
+				o[row][2] = x * r[0][2] + y * r[1][2] + z * r[2][2];
+			}
+		}
+
+		void rotate(Axis axis, bool positive) {
+			turn(getTurn(axis, positive));
+		}
+
+		void turnAround() {
+			turn(getTurnAround());
+		}
+
+		// move count segments along the turtle's z axis
+		void forward(unsigned count = 1) {
+			TurtleState& state = states[depth];
+			float distance = (float)segmentLength * count;
+			state.position.x += state.orientation[0][2] * distance;
+			state.position.y += state.orientation[1][2] * distance;
+			state.position.z += state.orientation[2][2] * distance;
+		}
+
+		void push() {
+			if(depth + 1 == states.size()) {
+				states.push_back(TurtleState()); // deeper than reserved
+			}
+			states[depth + 1] = states[depth];
+			depth++;
+		}
+
+		void pop() {
+			if(depth == 0) {
+				throw runtime_error("Turtle popped more states than it pushed");
+			}
+			depth--;
+		}
+};
+
+#endif
@@ -0,0 +1,126 @@
+
+#ifndef __TURTLECACHE_H_
+#define __TURTLECACHE_H_
+
+#include <string>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+#include "MappedFile.hpp"
+
+using std::string;
+
+// directory of derived turtle strings, keyed by a hash of everything that
+// determines them, so they only ever have to be derived once
+// each file is a fixed header followed by the raw string, which can be
+// mapped straight into memory
+class TurtleCache {
+	private:
+		string directory;
+
+		struct Header {
+			char magic[8];
+			unsigned long long hash;
+			unsigned long long length;
+		};
+
+		static const char* magic() {
+			return "TURTLE1";
+		}
+
+		string pathFor(unsigned long long hash) {
+			char name[32];
+			sprintf(name, "/%016llx.turtle", hash);
+			return directory + name;
+		}
+
+	public:
+		TurtleCache(string directory) {
+			this->directory = directory;
+#ifdef _WIN32
+			_mkdir(directory.c_str());
+#else
+			mkdir(directory.c_str(), 0755);
+#endif
+		}
+
+		// 64 bit FNV-1a, continuing from hash
+		static unsigned long long hashBytes(const char* bytes, size_t length,
+				unsigned long long hash = 14695981039346656037ULL) {
+			for(size_t i = 0; i < length; i++) {
+				hash ^= (unsigned char)bytes[i];
+				hash *= 1099511628211ULL;
+			}
+			return hash;
+		}
+
+		static unsigned long long hashString(const string& str,
+				unsigned long long hash = 14695981039346656037ULL) {
+			// include the terminator so "ab"+"c" differs from "a"+"bc"
+			return hashBytes(str.c_str(), str.size() + 1, hash);
+		}
+
+		// map the turtle string stored under hash into file
+		// returns false if it isn't cached or the file is bad
+		bool load(unsigned long long hash, MappedFile& file) {
+			if(!file.open(pathFor(hash).c_str())) {
+				return false;
+			}
+			Header header;
+			if(file.getSize() < sizeof(header)) {
+				file.close();
+				return false;
+			}
+			memcpy(&header, file.getData(), sizeof(header));
+			if(strncmp(header.magic, magic(), sizeof(header.magic)) != 0
+					|| header.hash != hash
+					|| header.length != file.getSize() - sizeof(header)) {
+				file.close();
+				return false;
+			}
+			return true;
+		}
+
+		// pointer to the turtle string in a file filled by load
+		static const char* getTurtleData(const MappedFile& file) {
+			return file.getData() + sizeof(Header);
+		}
+
+		static size_t getTurtleLength(const MappedFile& file) {
+			return file.getSize() - sizeof(Header);
+		}
+
+		// save a turtle string under hash, returns false on failure
+		bool store(unsigned long long hash, const string& turtleString) {
+			Header header;
+			memset(&header, 0, sizeof(header));
+			strncpy(header.magic, magic(), sizeof(header.magic));
+			header.hash = hash;
+			header.length = turtleString.size();
+
+			// write somewhere else first so a half written file is never loaded
+			string path = pathFor(hash);
+			string tempPath = path + ".tmp";
+			FILE* fp = fopen(tempPath.c_str(), "wb");
+			if(fp == NULL) {
+				return false;
+			}
+			bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+				&& fwrite(turtleString.data(), 1, turtleString.size(), fp) == turtleString.size();
+			ok = fclose(fp) == 0 && ok;
+			remove(path.c_str()); // windows won't rename over an existing file
+			if(!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+				remove(tempPath.c_str());
+				return false;
+			}
+			return true;
+		}
+};
+
+#endif
@@ -0,0 +1,426 @@
+
+#ifndef __TURTLEPROGRAM_H_
+#define __TURTLEPROGRAM_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <iostream>
+#include <string.h>
+
+#include "Angel.h"
+#include "TurtleSource.hpp"
+#include "Turtle.hpp"
+#include "Parallel.hpp"
+
+using std::string;
+using std::vector;
+using std::map;
+using std::pair;
+using std::cout;
+using std::endl;
+
+// a turtle string compiled into a compact list of commands
+// a peephole pass on the way in fuses runs of rotations into one matrix,
+// cancels rotations that undo each other, merges moves, drops symbols the
+// turtle ignores and removes branches that never draw anything
+class TurtleProgram {
+	public:
+		enum Opcode {
+			DRAW,   // draw a segment and move past it
+			MOVE,   // move forward operand segments without drawing
+			ROTATE, // multiply by rotation matrix number operand
+			PUSH,   // operand is how many commands on its pop is
+			POP     // operand is how many segments the branch drew
+		};
+
+		struct Command {
+			Opcode op;
+			unsigned operand;
+		};
+
+		// what the peephole pass got rid of
+		struct Stats {
+			unsigned long long symbols;      // symbols read in
+			unsigned long long commands;     // commands written out
+			unsigned long long deadSymbols;  // symbols the turtle ignores
+			unsigned long long turns;        // rotation symbols read in
+			unsigned long long turnCommands; // rotation commands written out
+			unsigned long long cancelled;    // rotations undone by their inverse
+			unsigned long long moves;        // f symbols read in
+			unsigned long long moveCommands; // move commands written out
+			unsigned long long deadCommands; // moves and turns right before a pop
+			unsigned long long emptyBranches; // branches that drew nothing
+			unsigned long long draws;        // segments the program draws
+		};
+
+		// a branch for runParallel to interpret, starting with state
+		struct Branch {
+			size_t begin, end;        // commands to run
+			size_t firstSegment;      // index of the first segment drawn
+			TurtleState state;
+		};
+
+	private:
+		vector<Command> commands;
+		vector<mat3> rotations;
+		vector<string> rotationRuns; // symbols each rotation matrix came from
+		map<string, unsigned> rotationIndex; // rotation matrix for each run
+		Stats stats;
+
+		Turtle* turtle; // turns come from here while compiling
+		string pendingRun; // rotations not yet written out
+		// for each open branch, where its push is and whether it drew
+		vector<size_t> branchStarts;
+		vector<bool> branchDrew;
+		bool balanced; // every push has a pop, so branches can be split off
+
+		static bool isRotation(char symbol) {
+			switch(symbol) {
+				case '+': case '-': case '&': case '^':
+				case '\\': case '/': case '|':
+					return true;
+			}
+			return false;
+		}
+
+		static char inverse(char symbol) {
+			switch(symbol) {
+				case '+': return '-';
+				case '-': return '+';
+				case '&': return '^';
+				case '^': return '&';
+				case '\\': return '/';
+				case '/': return '\\';
+			}
+			return symbol; // turning around undoes itself
+		}
+
+		const mat3& rotationFor(char symbol) {
+			return *turtle->getTurnFor(symbol);
+		}
+
+		void emit(Opcode op, unsigned operand) {
+			Command command;
+			command.op = op;
+			command.operand = operand;
+			commands.push_back(command);
+		}
+
+		void addRotation(char symbol) {
+			if(!pendingRun.empty() && pendingRun[pendingRun.size() - 1] == inverse(symbol)) {
+				pendingRun.erase(pendingRun.size() - 1);
+				stats.cancelled += 2;
+			} else {
+				pendingRun += symbol;
+			}
+		}
+
+		// write out the pending rotations as a single matrix
+		void flushRotations() {
+			if(!pendingRun.empty() && !commands.empty() && commands.back().op == ROTATE) {
+				// nothing in between was kept, so carry on the last run
+				string run = rotationRuns[commands.back().operand];
+				commands.pop_back();
+				string pending = pendingRun;
+				pendingRun = "";
+				for(string::iterator it = run.begin(); it != run.end(); ++it) {
+					addRotation(*it);
+				}
+				for(string::iterator it = pending.begin(); it != pending.end(); ++it) {
+					addRotation(*it);
+				}
+			}
+			if(pendingRun.empty()) {
+				return;
+			}
+
+			map<string, unsigned>::iterator found = rotationIndex.find(pendingRun);
+			unsigned index;
+			if(found != rotationIndex.end()) {
+				index = found->second;
+			} else {
+				mat3 matrix;
+				for(string::iterator it = pendingRun.begin(); it != pendingRun.end(); ++it) {
+					matrix *= rotationFor(*it);
+				}
+				index = rotations.size();
+				rotations.push_back(matrix);
+				rotationRuns.push_back(pendingRun);
+				rotationIndex[pendingRun] = index;
+			}
+			emit(ROTATE, index);
+			pendingRun = "";
+		}
+
+		// moves and turns that nothing draws after are pointless
+		void dropTrailingTransforms() {
+			stats.deadCommands += pendingRun.size();
+			pendingRun = "";
+			while(!commands.empty() && (commands.back().op == MOVE || commands.back().op == ROTATE)
+					&& (branchStarts.empty() || commands.size() > branchStarts.back() + 1)) {
+				stats.deadCommands++;
+				commands.pop_back();
+			}
+		}
+
+		// point each push at its pop and count the segments in between,
+		// so a branch can be skipped over or handed off without a scan
+		void linkBranches() {
+			vector<size_t> pushes;
+			vector<unsigned long long> drawsAtPush;
+			unsigned long long draws = 0;
+			balanced = true;
+			for(size_t i = 0; i < commands.size(); i++) {
+				switch(commands[i].op) {
+					case DRAW:
+						draws++;
+						break;
+					case PUSH:
+						pushes.push_back(i);
+						drawsAtPush.push_back(draws);
+						break;
+					case POP:
+						if(pushes.empty()) {
+							balanced = false;
+							break;
+						}
+						commands[pushes.back()].operand = i - pushes.back();
+						commands[i].operand = draws - drawsAtPush.back();
+						pushes.pop_back();
+						drawsAtPush.pop_back();
+						break;
+					default:
+						break;
+				}
+			}
+			balanced = balanced && pushes.empty();
+			stats.draws = draws;
+		}
+
+		// interpret commands [branch.begin, branch.end) from branch.state
+		// branches longer than grain are queued for any worker to take
+		template<typename Drawer>
+		void runBranch(const Branch& branch, Turtle* turtle, Drawer& draw,
+				WorkQueue<Branch>& queue, unsigned worker, size_t grain) const {
+			turtle->start(branch.state);
+			size_t segment = branch.firstSegment;
+			for(size_t i = branch.begin; i < branch.end; i++) {
+				const Command& command = commands[i];
+				switch(command.op) {
+					case DRAW:
+						draw(turtle, segment);
+						segment++;
+						turtle->forward();
+						break;
+					case MOVE:
+						turtle->forward(command.operand);
+						break;
+					case ROTATE:
+						turtle->turn(rotations[command.operand]);
+						break;
+					case PUSH:
+						if(command.operand > grain) {
+							size_t pop = i + command.operand;
+							Branch split = { i + 1, pop, segment, turtle->getState() };
+							queue.push(worker, split);
+							segment += commands[pop].operand;
+							i = pop; // turtle is back where it was after the pop
+						} else {
+							turtle->push();
+						}
+						break;
+					case POP:
+						turtle->pop();
+						break;
+				}
+			}
+		}
+
+		void addSymbol(char symbol) {
+			stats.symbols++;
+			if(isRotation(symbol)) {
+				stats.turns++;
+				addRotation(symbol);
+				return;
+			}
+			switch(symbol) {
+				case 'F':
+					flushRotations();
+					emit(DRAW, 0);
+					if(!branchDrew.empty()) {
+						branchDrew.back() = true;
+					}
+					break;
+				case 'f':
+					stats.moves++;
+					flushRotations();
+					if(!commands.empty() && commands.back().op == MOVE) {
+						commands.back().operand++;
+					} else {
+						emit(MOVE, 1);
+					}
+					break;
+				case '[':
+					flushRotations();
+					branchStarts.push_back(commands.size());
+					branchDrew.push_back(false);
+					emit(PUSH, 0);
+					break;
+				case ']':
+					dropTrailingTransforms();
+					if(branchStarts.empty()) {
+						emit(POP, 0); // unbalanced, let the turtle complain
+					} else if(!branchDrew.back()) {
+						stats.deadCommands += commands.size() - branchStarts.back() - 1;
+						commands.resize(branchStarts.back());
+						stats.emptyBranches++;
+						branchStarts.pop_back();
+						branchDrew.pop_back();
+					} else {
+						emit(POP, 0);
+						branchStarts.pop_back();
+						branchDrew.pop_back();
+						if(!branchDrew.empty()) {
+							branchDrew.back() = true;
+						}
+					}
+					break;
+				default:
+					stats.deadSymbols++;
+			}
+		}
+
+	public:
+		// compile every symbol from source, using turtle's turn matrices
+		TurtleProgram(TurtleSource* source, Turtle* turtle) {
+			this->turtle = turtle;
+			memset(&stats, 0, sizeof(stats));
+
+			char symbol;
+			while(source->next(symbol)) {
+				addSymbol(symbol);
+			}
+			if(branchStarts.empty()) {
+				dropTrailingTransforms(); // nothing comes after the end
+			} else {
+				flushRotations();
+			}
+			stats.commands = commands.size();
+			for(vector<Command>::const_iterator i = commands.begin(); i != commands.end(); ++i) {
+				stats.turnCommands += i->op == ROTATE ? 1 : 0;
+				stats.moveCommands += i->op == MOVE ? 1 : 0;
+			}
+			linkBranches();
+			rotationIndex.clear();
+			branchStarts.clear();
+			branchDrew.clear();
+			this->turtle = NULL;
+		}
+
+		// interpret the program with turtle, calling draw(turtle) at the
+		// start of every segment - only matrix multiplies, no trig
+		template<typename Drawer>
+		void run(Turtle* turtle, Drawer& draw) const {
+			for(vector<Command>::const_iterator i = commands.begin(); i != commands.end(); ++i) {
+				switch(i->op) {
+					case DRAW:
+						draw(turtle);
+						turtle->forward();
+						break;
+					case MOVE:
+						turtle->forward(i->operand);
+						break;
+					case ROTATE:
+						turtle->turn(rotations[i->operand]);
+						break;
+					case PUSH:
+						turtle->push();
+						break;
+					case POP:
+						turtle->pop();
+						break;
+				}
+			}
+		}
+
+		// interpret the program across workers threads, calling
+		// draw(turtle, segment) at the start of every segment with the
+		// segment's index in the order run would draw it
+		// draw is called from several threads at once, each with its own turtle
+		// falls back to run order on one thread if the brackets don't match
+		template<typename Drawer>
+		void runParallel(Turtle* turtle, Drawer& draw, unsigned workers) const {
+			if(!balanced || workers <= 1) {
+				size_t segment = 0;
+				auto indexed = [&](Turtle* t) { draw(t, segment); segment++; };
+				run(turtle, indexed);
+				return;
+			}
+
+			vector<Turtle*> turtles(workers);
+			for(unsigned w = 0; w < workers; w++) {
+				turtles[w] = new Turtle(*turtle);
+			}
+			// enough branches that workers can steal from each other
+			size_t grain = std::max<size_t>(256, commands.size() / (workers * 64));
+			WorkQueue<Branch> queue(workers);
+			Branch trunk = { 0, commands.size(), 0, turtle->getState() };
+			queue.push(0, trunk);
+			queue.run([&](unsigned worker, const Branch& branch) {
+				runBranch(branch, turtles[worker], draw, queue, worker, grain);
+			});
+			for(unsigned w = 0; w < workers; w++) {
+				delete turtles[w];
+			}
+		}
+
+		// add the segments drawn by every bracketed branch with at least
+		// minSegments of them to out, as [first, last) in drawing order
+		void getBranches(vector<pair<size_t, size_t> >& out, unsigned long long minSegments) const {
+			size_t segment = 0;
+			for(size_t i = 0; i < commands.size(); i++) {
+				if(commands[i].op == DRAW) {
+					segment++;
+				} else if(commands[i].op == PUSH) {
+					const Command& pop = commands[i + commands[i].operand];
+					if(pop.op == POP && pop.operand >= std::max(minSegments, 1ULL)) {
+						out.push_back(pair<size_t, size_t>(segment, segment + pop.operand));
+					}
+				}
+			}
+		}
+
+		// false if some bracket has no partner
+		bool isBalanced() const {
+			return balanced;
+		}
+
+		const vector<Command>& getCommands() const {
+			return commands;
+		}
+
+		const mat3& getRotation(unsigned index) const {
+			return rotations[index];
+		}
+
+		const Stats& getStats() const {
+			return stats;
+		}
+
+		void printStats(string name) const {
+			cout << name << " program: " << stats.symbols << " symbols -> "
+				<< stats.commands << " commands" << endl
+				<< "  turns " << stats.turns << " -> " << stats.turnCommands
+				<< " (" << stats.cancelled << " cancelled, "
+				<< rotations.size() << " distinct matrices)" << endl
+				<< "  moves " << stats.moves << " -> " << stats.moveCommands << endl
+				<< "  dead symbols " << stats.deadSymbols
+				<< ", dead moves/turns " << stats.deadCommands
+				<< ", empty branches " << stats.emptyBranches << endl;
+		}
+};
+
+#endif
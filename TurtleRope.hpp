@@ -0,0 +1,198 @@
+
+#ifndef __TURTLEROPE_H_
+#define __TURTLEROPE_H_
+
+#include <string>
+#include <vector>
+
+#include "CompiledGrammar.hpp"
+#include "TurtleSource.hpp"
+
+using std::string;
+using std::vector;
+
+// a derived turtle string stored as a DAG of shared expansions
+// generation n is made of copies of the same few generation n-1 expansions,
+// so each (symbol, generations left) expansion is built once and referenced
+// everywhere it occurs - memory is O(rules * iterations), not exponential
+class TurtleRope {
+	private:
+		struct Node {
+			string literal;           // symbols of a fully derived leaf
+			vector<unsigned> children; // nodes to concatenate otherwise
+			unsigned long long length; // symbols once fully expanded
+		};
+
+		vector<Node> nodes;
+		unsigned root;
+		unsigned iterations;
+		// memo[k][c] is the node for c with k generations left, or NONE
+		vector<vector<unsigned> > memo;
+		static const unsigned NONE = ~0u;
+
+		unsigned addLiteral(const char* symbols, unsigned length) {
+			Node node;
+			node.literal.assign(symbols, length);
+			node.length = length;
+			nodes.push_back(node);
+			return nodes.size() - 1;
+		}
+
+		// node for c expanded k more times, building it if it doesn't exist
+		unsigned build(const CompiledGrammar* grammar, char c, unsigned k) {
+			unsigned& cached = memo[k][(unsigned char)c];
+			if(cached != NONE) {
+				return cached;
+			}
+
+			unsigned id;
+			if(k == 0) {
+				id = addLiteral(&c, 1);
+			} else if(k == 1 || grammar->isIdentity(CompiledGrammar::RULES, c)) {
+				// last generation, or no rule so c only changes at the end
+				id = addLiteral(grammar->getExpansion(CompiledGrammar::FINAL, c),
+					grammar->getExpansionLength(CompiledGrammar::FINAL, c));
+			} else {
+				const char* rhs = grammar->getExpansion(CompiledGrammar::RULES, c);
+				unsigned rhsLength = grammar->getExpansionLength(CompiledGrammar::RULES, c);
+				Node node;
+				node.length = 0;
+				for(unsigned i = 0; i < rhsLength; i++) {
+					unsigned child = build(grammar, rhs[i], k - 1);
+					node.children.push_back(child);
+					node.length = CompiledGrammar::saturatingAdd(node.length, nodes[child].length);
+				}
+				nodes.push_back(node);
+				id = nodes.size() - 1;
+			}
+			cached = id; // memo is sized up front, so this is still valid
+			return id;
+		}
+
+	public:
+		TurtleRope(const CompiledGrammar* grammar, const string& start, unsigned iterations) {
+			this->iterations = iterations;
+			memo.assign(iterations + 1, vector<unsigned>(256, (unsigned)NONE));
+
+			Node top;
+			top.length = 0;
+			for(string::const_iterator it = start.begin(); it != start.end(); ++it) {
+				unsigned child;
+				if(iterations == 0) {
+					child = addLiteral(grammar->getExpansion(CompiledGrammar::REPLACEMENTS, *it),
+						grammar->getExpansionLength(CompiledGrammar::REPLACEMENTS, *it));
+				} else {
+					child = build(grammar, *it, iterations);
+				}
+				top.children.push_back(child);
+				top.length = CompiledGrammar::saturatingAdd(top.length, nodes[child].length);
+			}
+			nodes.push_back(top);
+			root = nodes.size() - 1;
+			memo.clear(); // only needed while building
+		}
+
+		unsigned getIterations() {
+			return iterations;
+		}
+
+		unsigned getNumNodes() const {
+			return nodes.size();
+		}
+
+		// length of the turtle string this represents
+		unsigned long long getLength() {
+			return nodes[root].length;
+		}
+
+		// bytes used to store the rope's nodes
+		unsigned long long getStoredBytes() {
+			unsigned long long bytes = 0;
+			for(vector<Node>::const_iterator i = nodes.begin(); i != nodes.end(); ++i) {
+				bytes += sizeof(Node) + i->literal.size() + i->children.size() * sizeof(unsigned);
+			}
+			return bytes;
+		}
+
+		// how many times smaller the rope is than the string it represents
+		double getCompressionRatio() {
+			return (double)getLength() / getStoredBytes();
+		}
+
+		// nodes are numbered so children always come before their parents
+		unsigned getRoot() const {
+			return root;
+		}
+
+		bool isLeaf(unsigned node) const {
+			return nodes[node].children.empty();
+		}
+
+		const string& getLiteral(unsigned node) const {
+			return nodes[node].literal;
+		}
+
+		const vector<unsigned>& getChildren(unsigned node) const {
+			return nodes[node].children;
+		}
+
+		// walks the rope's symbols in order, keeping one frame per level
+		class Iterator : public TurtleSource {
+			private:
+				struct Frame {
+					unsigned node;
+					unsigned position;
+				};
+
+				const TurtleRope* rope;
+				vector<Frame> frames;
+
+				void pushFrame(unsigned node) {
+					Frame frame;
+					frame.node = node;
+					frame.position = 0;
+					frames.push_back(frame);
+				}
+
+			public:
+				Iterator(const TurtleRope* rope) {
+					this->rope = rope;
+					frames.reserve(rope->iterations + 2);
+					reset();
+				}
+
+				void reset() {
+					frames.clear();
+					pushFrame(rope->root);
+				}
+
+				bool next(char& symbol) {
+					while(!frames.empty()) {
+						Frame& top = frames.back();
+						const Node& node = rope->nodes[top.node];
+						if(node.children.empty()) {
+							if(top.position < node.literal.size()) {
+								symbol = node.literal[top.position];
+								top.position++;
+								return true;
+							}
+							frames.pop_back();
+						} else if(top.position < node.children.size()) {
+							unsigned child = node.children[top.position];
+							top.position++;
+							pushFrame(child); // top is invalidated
+						} else {
+							frames.pop_back();
+						}
+					}
+					return false;
+				}
+		};
+
+		// caller is responsible for freeing memory
+		Iterator* getIterator() {
+			return new Iterator(this);
+		}
+};
+
+#endif
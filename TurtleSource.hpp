@@ -0,0 +1,50 @@
+
+#ifndef __TURTLESOURCE_H_
+#define __TURTLESOURCE_H_
+
+#include <stddef.h>
+
+// anything that hands out the symbols of a turtle string in order
+class TurtleSource {
+	public:
+		// put the next symbol into symbol
+		// returns false once there are no symbols left
+		virtual bool next(char& symbol) = 0;
+
+		// go back to the first symbol
+		virtual void reset() = 0;
+
+		virtual ~TurtleSource() {
+		}
+};
+
+// reads symbols out of a turtle string that is already in memory
+// the memory must outlive the source
+class StringSource : public TurtleSource {
+	private:
+		const char* symbols;
+		size_t length;
+		size_t position;
+
+	public:
+		StringSource(const char* symbols, size_t length) {
+			this->symbols = symbols;
+			this->length = length;
+			position = 0;
+		}
+
+		bool next(char& symbol) {
+			if(position == length) {
+				return false;
+			}
+			symbol = symbols[position];
+			position++;
+			return true;
+		}
+
+		void reset() {
+			position = 0;
+		}
+};
+
+#endif
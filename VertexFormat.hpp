@@ -0,0 +1,198 @@
+#ifndef __VERTEXFORMAT_H_
+#define __VERTEXFORMAT_H_
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "Angel.h"
+
+// ways of storing positions and normals in a vertex buffer, from four
+// floats each down to 8 bytes a position and 4 a normal
+// the vertex shader turns every stored position p back into
+// p * position_scale + position_offset, which only does anything for
+// positions quantized against a box around the mesh
+class VertexFormat {
+	public:
+		enum Position {
+			FLOAT4,  // x, y, z and a w of 1, 16 bytes
+			FLOAT3,  // x, y and z, 12 bytes
+			HALF,    // half floats, padded to 8 bytes
+			SNORM16, // 16 bit integers across the mesh's box, padded to 8 bytes
+			NUM_POSITION_FORMATS
+		};
+
+		enum Normal {
+			NORMAL_FLOAT4,     // x, y, z and a w of 0, 16 bytes
+			NORMAL_OCTAHEDRAL, // two 16 bit integers, 4 bytes
+			NORMAL_10_10_10_2, // 10 bits for each of x, y and z, 4 bytes
+			NUM_NORMAL_FORMATS
+		};
+
+		static const char* name(Position format) {
+			static const char* names[] = { "float4", "float3", "half", "snorm16" };
+			return names[format];
+		}
+
+		static const char* name(Normal format) {
+			static const char* names[] = { "float4", "octahedral", "10:10:10:2" };
+			return names[format];
+		}
+
+		// bytes per vertex
+		static GLsizei stride(Position format) {
+			static const GLsizei strides[] = { 16, 12, 8, 8 };
+			return strides[format];
+		}
+
+		static GLsizei stride(Normal format) {
+			static const GLsizei strides[] = { 16, 4, 4 };
+			return strides[format];
+		}
+
+		// position_scale and position_offset for count positions stored
+		// in format, into scale and offset
+		static void decoding(Position format, const vec3* positions, unsigned count,
+				vec4& scale, vec4& offset) {
+			scale = vec4(1, 1, 1, 0);
+			offset = vec4(0, 0, 0, 0);
+			if(format != SNORM16 || count == 0) {
+				return;
+			}
+			vec3 min = positions[0], max = positions[0];
+			for(unsigned i = 1; i < count; i++) {
+				for(int axis = 0; axis < 3; axis++) {
+					min[axis] = std::min(min[axis], positions[i][axis]);
+					max[axis] = std::max(max[axis], positions[i][axis]);
+				}
+			}
+			for(int axis = 0; axis < 3; axis++) {
+				offset[axis] = (min[axis] + max[axis]) / 2;
+				scale[axis] = (max[axis] - min[axis]) / 2 / 32767;
+			}
+		}
+
+		// store count positions in format at out, where decoding gave
+		// scale and offset for them
+		static void pack(Position format, const vec3* positions, unsigned count,
+				const vec4& scale, const vec4& offset, void* out) {
+			char* bytes = (char*)out;
+			for(unsigned i = 0; i < count; i++, bytes += stride(format)) {
+				const vec3& p = positions[i];
+				if(format == FLOAT4) {
+					vec4 point(p, 1);
+					memcpy(bytes, &point, sizeof(point));
+				} else if(format == FLOAT3) {
+					memcpy(bytes, &p, sizeof(p));
+				} else {
+					GLushort packed[4] = { 0, 0, 0, 0 };
+					for(int axis = 0; axis < 3; axis++) {
+						if(format == HALF) {
+							packed[axis] = toHalf(p[axis]);
+						} else {
+							float s = scale[axis] == 0 ? 0 : (p[axis] - offset[axis]) / scale[axis];
+							packed[axis] = (GLshort)lround(std::max(-32767.0f, std::min(32767.0f, s)));
+						}
+					}
+					memcpy(bytes, packed, sizeof(packed));
+				}
+			}
+		}
+
+		// store count normals in format at out
+		// octahedral normals have to be unfolded by the shader that reads
+		// them: n = vec3(e, 1 - |e.x| - |e.y|), and where n.z < 0,
+		// n.xy = (1 - |n.yx|) * sign(n.xy), then normalize
+		static void pack(Normal format, const vec4* normals, unsigned count, void* out) {
+			char* bytes = (char*)out;
+			for(unsigned i = 0; i < count; i++, bytes += stride(format)) {
+				vec3 n(normals[i].x, normals[i].y, normals[i].z);
+				if(format == NORMAL_FLOAT4) {
+					vec4 normal(n, 0);
+					memcpy(bytes, &normal, sizeof(normal));
+				} else if(format == NORMAL_OCTAHEDRAL) {
+					// fold the octahedron |x| + |y| + |z| = 1 out flat
+					float sum = fabs(n.x) + fabs(n.y) + fabs(n.z);
+					float x = sum == 0 ? 0 : n.x / sum, y = sum == 0 ? 0 : n.y / sum;
+					if(n.z < 0) {
+						float foldedX = (1 - fabs(y)) * (x >= 0 ? 1 : -1);
+						y = (1 - fabs(x)) * (y >= 0 ? 1 : -1);
+						x = foldedX;
+					}
+					GLshort packed[2] = { (GLshort)lround(x * 32767), (GLshort)lround(y * 32767) };
+					memcpy(bytes, packed, sizeof(packed));
+				} else {
+					GLuint packed = 0;
+					for(int axis = 0; axis < 3; axis++) {
+						int value = lround(std::max(-1.0f, std::min(1.0f, n[axis])) * 511);
+						packed |= ((GLuint)value & 0x3ff) << (axis * 10);
+					}
+					memcpy(bytes, &packed, sizeof(packed));
+				}
+			}
+		}
+
+		// point attribute location at positions stored in format, starting
+		// offset bytes into the bound vertex buffer
+		static void setAttribute(Position format, GLint location, GLsizeiptr offset) {
+			if(format == FLOAT4) {
+				glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride(format), BUFFER_OFFSET(offset));
+			} else if(format == FLOAT3) {
+				glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride(format), BUFFER_OFFSET(offset));
+			} else if(format == HALF) {
+				glVertexAttribPointer(location, 3, GL_HALF_FLOAT, GL_FALSE, stride(format), BUFFER_OFFSET(offset));
+			} else {
+				// left as integers, position_scale takes them back
+				glVertexAttribPointer(location, 3, GL_SHORT, GL_FALSE, stride(format), BUFFER_OFFSET(offset));
+			}
+		}
+
+		static void setAttribute(Normal format, GLint location, GLsizeiptr offset) {
+			if(format == NORMAL_FLOAT4) {
+				glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride(format), BUFFER_OFFSET(offset));
+			} else if(format == NORMAL_OCTAHEDRAL) {
+				glVertexAttribPointer(location, 2, GL_SHORT, GL_TRUE, stride(format), BUFFER_OFFSET(offset));
+			} else {
+				glVertexAttribPointer(location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride(format),
+					BUFFER_OFFSET(offset));
+			}
+		}
+
+		// nearest half float to value, ties to even
+		static GLushort toHalf(float value) {
+			GLuint bits;
+			memcpy(&bits, &value, sizeof(bits));
+			GLuint sign = (bits >> 16) & 0x8000;
+			int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+			GLuint mantissa = bits & 0x7fffff;
+			if(((bits >> 23) & 0xff) == 0xff) {
+				return sign | (mantissa != 0 ? 0x7e00 : 0x7c00); // nan or infinity
+			}
+			if(exponent >= 31) {
+				return sign | 0x7c00; // too big
+			}
+			GLuint half, remainder, halfway;
+			if(exponent <= 0) {
+				// subnormal, or too small to be anything but zero
+				if(exponent < -10) {
+					return sign;
+				}
+				mantissa |= 0x800000;
+				int shift = 14 - exponent;
+				half = mantissa >> shift;
+				remainder = mantissa & ((1u << shift) - 1);
+				halfway = 1u << (shift - 1);
+			} else {
+				half = (exponent << 10) | (mantissa >> 13);
+				remainder = mantissa & 0x1fff;
+				halfway = 0x1000;
+			}
+			// rounding up can carry into the exponent, which is right
+			if(remainder > halfway || (remainder == halfway && (half & 1))) {
+				half++;
+			}
+			return sign | half;
+		}
+};
+
+#endif
@@ -5,6 +5,7 @@
 	#include "unix_dirent.h"
 #endif
 #include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <time.h>
 
@@ -23,10 +24,12 @@ void keyboard(unsigned char key, int x, int y);
 
 LSystemRenderer* lsysRenderer;
 Scene* scene;
+float forestDensity = 0.005; // trees per square unit of ground
+const float maxForestDensity = 500; // '>' stops here
 
 using namespace std;
 
-GLuint setUpShaders(void) {	
+ShaderProgram* setUpShaders(void) {	
 	// Create a vertex array object
 	GLuint vao;
 	glGenVertexArrays(1, &vao);
@@ -38,8 +41,8 @@ GLuint setUpShaders(void) {
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 
 	// Load shaders and use the resulting shader program
-	GLuint program = InitShader("vshader1.glsl", "fshader1.glsl");
-	glUseProgram(program);
+	ShaderProgram* program = new ShaderProgram("vshader1.glsl", "fshader1.glsl");
+	glUseProgram(program->getId());
 
 	// sets the default color to clear screen
 	glClearColor(0,0,0, 1.0); // black background
@@ -56,6 +59,13 @@ void reshape(int screenWidth, int screenHeight) {
 	scene->reshape(screenWidth, screenHeight);
 }
 
+// plant a forest over the ground in view
+void showForest() {
+	vec3 max(10, 0, 10);
+	vec3 min(-30, 0, -30);
+	lsysRenderer->showForest(min, max, forestDensity, rand());
+}
+
 //----------------------------------------------------------------------------
 
 // keyboard handler
@@ -71,10 +81,41 @@ void keyboard(unsigned char key, int x, int y) {
 		case 'e':
 			lsysRenderer->showOneSystem(key - 'a');
 			break;
+		case '+':
+		case '=':
+			lsysRenderer->stepIterations(1);
+			break;
+		case '-':
+			lsysRenderer->stepIterations(-1);
+			break;
+		case 'i':
+			lsysRenderer->toggleInstancing();
+			break;
+		case 'l':
+			lsysRenderer->toggleLevelOfDetail();
+			break;
+		case 'k':
+			lsysRenderer->toggleBaking();
+			break;
+		case 'r':
+			lsysRenderer->toggleRopeStreaming();
+			break;
+		case 't':
+			scene->toggleStats();
+			break;
+		case 'v':
+			scene->cycleVertexFormat();
+			break;
 		case 'f':
-			vec3 max(10, 0, 10);
-			vec3 min(-30, 0, -30);
-			lsysRenderer->showAllSystemsRandomly(min, max);
+			showForest();
+			break;
+		case '>':
+			forestDensity = std::min(forestDensity * 10, maxForestDensity);
+			showForest();
+			break;
+		case '<':
+			forestDensity /= 10;
+			showForest();
 			break;
 	}
 	glutPostRedisplay();
@@ -98,25 +139,193 @@ vector<string>* getFileNames(const char* path) {
 	return names;
 }
 
+// time interpreting sys's program on one thread and on all of them
+void benchmarkInterpretation(LSystem* sys, TurtleProgram* turtleProgram) {
+	vector<mat4> transforms(turtleProgram->getStats().draws);
+	auto record = [&](Turtle* turtle, size_t segment) {
+		transforms[segment] = turtle->getTransform();
+	};
+	unsigned workerCounts[2] = { 1, sys->workers };
+	for(int i = 0; i < 2; i++) {
+		Turtle* turtle = sys->getTurtleCopy();
+		turtle->start(RotateX(-90));
+		double start = secondsNow();
+		turtleProgram->runParallel(turtle, record, workerCounts[i]);
+		double seconds = secondsNow() - start;
+		delete turtle;
+		cout << sys->getName() << " interpret on " << workerCounts[i] << " threads: "
+			<< transforms.size() << " segments, " << seconds * 1000 << " ms, "
+			<< transforms.size() / seconds / 1e6 << "M segments/s" << endl;
+	}
+
+	double start = secondsNow();
+	SubtreeInstancer* subtrees = sys->getInstancer();
+	double buildSeconds = secondsNow() - start;
+	if(subtrees == NULL) {
+		return;
+	}
+	auto place = [&](const TurtleState& state, size_t segment) {
+		transforms[segment] = stateTransform(state);
+	};
+	Turtle* turtle = sys->getTurtleCopy();
+	turtle->start(RotateX(-90));
+	start = secondsNow();
+	subtrees->run(turtle->getState(), place);
+	double seconds = secondsNow() - start;
+	delete turtle;
+	subtrees->printStats(sys->getName());
+	cout << sys->getName() << " subtrees: built in " << buildSeconds * 1000
+		<< " ms, placed in " << seconds * 1000 << " ms, "
+		<< transforms.size() / seconds / 1e6 << "M segments/s" << endl;
+}
+
+// time drawing forests of 1k, 10k and 100k trees planted density trees
+// per square unit around where the camera looks
+void benchmarkForest(ShaderProgram* program, float density) {
+	scene->reshape(512, 512);
+	unsigned counts[3] = { 1000, 10000, 100000 };
+	for(int i = 0; i < 3; i++) {
+		float half = sqrt(counts[i] / density) / 2;
+		vec3 center(-20, 0, -20);
+		lsysRenderer->showForest(center - vec3(half, 0, half), center + vec3(half, 0, half), density, 1);
+		// the first frames build, bake and rebuffer
+		for(int frame = 0; frame < 3; frame++) {
+			scene->display();
+		}
+		const int frames = 10;
+		unsigned long long calls = 0, culled = 0;
+		double start = secondsNow();
+		for(int frame = 0; frame < frames; frame++) {
+			scene->display();
+			glFinish();
+			calls += program->getCallCount();
+			culled += lsysRenderer->getCulledTrees();
+		}
+		double seconds = secondsNow() - start;
+		cout << lsysRenderer->getNumTrees() << " trees: " << seconds / frames * 1000 << " ms/frame, "
+			<< calls / frames << " GL calls/frame, " << culled / frames << " trees culled/frame" << endl;
+	}
+}
+
+// what mesh takes in memory and to upload, against storing it as triangle
+// soup with a point, a normal and half a normal line per corner as before
+void reportMeshMemory(Mesh* mesh) {
+	unsigned long long triangles = mesh->getNumIndices() / 3;
+	unsigned long long soupUpload = triangles * 3 * sizeof(vec4);
+	unsigned long long soupBytes = mesh->getNumVertices() * sizeof(vec4) + 2 * soupUpload
+		+ triangles * 2 * sizeof(vec4);
+	unsigned long long upload = mesh->getNumBytes() + mesh->getNumIndexBytes();
+	cout << mesh->getName() << ": " << mesh->getNumVertices() << " vertices, " << triangles
+		<< " triangles, " << mesh->getNumHostBytes() / 1024 << " KB with "
+		<< mesh->getIndexSize() * 8 << " bit indices vs " << soupBytes / 1024
+		<< " KB as triangle soup, " << upload / 1024 << " KB uploaded vs "
+		<< soupUpload / 1024 << " KB" << endl;
+	cout << "  vertex buffer with positions as";
+	for(int format = 0; format < VertexFormat::NUM_POSITION_FORMATS; format++) {
+		cout << (format == 0 ? " " : ", ") << VertexFormat::name((VertexFormat::Position)format) << " "
+			<< mesh->getNumVertices() * VertexFormat::stride((VertexFormat::Position)format) / 1024 << " KB";
+	}
+	cout << endl;
+}
+
+// time loading every mesh with the scanning reader and the original line
+// by line one
+void benchmarkMeshLoading() {
+	vector<string>* names = getFileNames("meshes");
+	std::sort(names->begin(), names->end());
+	const int repeats = 10;
+	for(vector<string>::const_iterator i = names->begin(); i != names->end(); ++i) {
+		MappedFile file;
+		if(!file.open(i->c_str())) {
+			continue;
+		}
+		double megabytes = file.getSize() / 1e6;
+		double seconds[2];
+		for(int scanning = 0; scanning < 2; scanning++) {
+			unsigned vertices = 0;
+			double start = secondsNow();
+			for(int r = 0; r < repeats; r++) {
+				PLYReader reader(i->c_str());
+				Mesh* mesh = scanning ? reader.read() : reader.readByLines();
+				vertices = mesh->getNumVertices();
+				delete mesh;
+			}
+			seconds[scanning] = (secondsNow() - start) / repeats;
+			cout << *i << (scanning ? " scanning: " : " line by line: ")
+				<< seconds[scanning] * 1000 << " ms, " << megabytes / seconds[scanning] << " MB/s, "
+				<< vertices / seconds[scanning] / 1e6 << "M vertices/s" << endl;
+		}
+		cout << *i << ": " << seconds[0] / seconds[1] << "x faster" << endl;
+		PLYReader reader(i->c_str());
+		Mesh* mesh = reader.read();
+		reportMeshMemory(mesh);
+		delete mesh;
+	}
+	delete names;
+}
+
+// derive every system on one thread and then on all of them,
+// printing the throughput of each generation
+void benchmarkDerivation(vector<LSystem*>& lsystems, unsigned extraIterations) {
+	for(vector<LSystem*>::const_iterator i = lsystems.begin(); i != lsystems.end(); ++i) {
+		LSystem* sys = *i;
+		sys->setCache(NULL); // time real derivations, not cache hits
+		sys->iterations += extraIterations;
+		size_t threshold = sys->parallelThreshold;
+		for(int parallel = 0; parallel < 2; parallel++) {
+			sys->parallelThreshold = parallel ? 1 : 0;
+			sys->clearTurtleString();
+			sys->getTurtleString();
+			cout << sys->getName() << (parallel ? " parallel" : " serial") << ":" << endl;
+			for(unsigned gen = 0; gen < sys->derivationStats.size(); gen++) {
+				LSystem::GenerationStats stats = sys->derivationStats[gen];
+				cout << "  gen " << gen + 1 << ": " << stats.bytes << " bytes, "
+					<< stats.seconds * 1000 << " ms, "
+					<< stats.bytes / stats.seconds / 1e9 << " GB/s" << endl;
+			}
+		}
+		TurtleRope* rope = sys->getRope();
+		cout << sys->getName() << " rope: " << rope->getNumNodes() << " nodes, "
+			<< rope->getStoredBytes() << " bytes for " << rope->getLength()
+			<< " symbols, " << rope->getCompressionRatio() << "x compression" << endl;
+		TurtleProgram* turtleProgram = sys->getProgram();
+		if(turtleProgram != NULL) {
+			turtleProgram->printStats(sys->getName());
+			benchmarkInterpretation(sys, turtleProgram);
+		}
+		sys->parallelThreshold = threshold;
+		sys->iterations -= extraIterations;
+		sys->clearTurtleString();
+	}
+}
 
 //----------------------------------------------------------------------------
 // entry point
 int main(int argc, char **argv) {
-	// init glut
-	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
-	glutInitWindowSize(512, 512);
-
 	// get a list of all the mesh data in meshes directory
 	vector<string>* names = getFileNames("lsystems");
 	std::sort(names->begin(), names->end());
 	vector<LSystem*> lsystems = vector<LSystem*>();
+	TurtleCache* cache = new TurtleCache("cache");
 	for(vector<string>::const_iterator i = names->begin(); i != names->end(); ++i) {
 		LSystemReader reader((*i).c_str());
 		lsystems.push_back(reader.read());
+		lsystems.back()->setCache(cache);
 		//lsystems[lsystems.size() - 1]->print();
 	}
 
+	// "hw3 bench [extra iterations]" times mesh loading and derivation and exits
+	if(argc > 1 && string(argv[1]) == "bench") {
+		benchmarkMeshLoading();
+		benchmarkDerivation(lsystems, argc > 2 ? atoi(argv[2]) : 2);
+		return 0;
+	}
+
+	// init glut
+	glutInit(&argc, argv);
+	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+	glutInitWindowSize(512, 512);
+
 
 	// If you are using freeglut, the next two lines will check if 
 	// the code is truly 3.2. Otherwise, comment them out
@@ -125,7 +334,7 @@ int main(int argc, char **argv) {
 	// with different cases
 	// this is a good time to find out information about
 	// your graphics hardware before you allocate any memory
-	glutInitContextVersion(3, 1);
+	glutInitContextVersion(3, 3);
 	glutInitContextProfile(GLUT_CORE_PROFILE);
 
 	// create window
@@ -135,13 +344,20 @@ int main(int argc, char **argv) {
 	// init glew
 	glewInit();
 
-	GLuint program = setUpShaders();
+	ShaderProgram* program = setUpShaders();
 
 	srand(time(NULL));
 	lsystems[0]->print();
 	lsysRenderer = new LSystemRenderer(program, lsystems);
 	scene = new Scene(program, *lsysRenderer);
 	scene->bufferPoints();
+
+	// "hw3 forest [density]" times drawing big forests and exits
+	if(argc > 1 && string(argv[1]) == "forest") {
+		benchmarkForest(program, argc > 2 ? atof(argv[2]) : 0.05);
+		return 0;
+	}
+
 	// assign handlers
 	glutDisplayFunc(display);
 	glutKeyboardFunc(keyboard);
@@ -2,9 +2,17 @@
 
 uniform mat4 projection_matrix;
 uniform mat4 model_matrix;
+uniform bool instanced; // place with instance_matrix, then model_matrix
+// a mesh's own positions are vPosition * position_scale + position_offset,
+// which undoes however they were stored
+uniform vec4 position_scale;
+uniform vec4 position_offset;
 
 in vec4 vPosition;
+in mat4 instance_matrix; // rows of a row-major matrix, one per instance
 
 void main() {
-	gl_Position = projection_matrix*model_matrix*vPosition;
+	mat4 model = instanced ? model_matrix*transpose(instance_matrix) : model_matrix;
+	vec4 position = vec4(vPosition.xyz * position_scale.xyz + position_offset.xyz, 1.0);
+	gl_Position = projection_matrix*model*position;
 }